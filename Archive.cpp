@@ -0,0 +1,425 @@
+#include "Archive.h"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QtEndian>
+
+#include <algorithm>
+
+#include "FileHeader.h"
+
+using namespace Crypto;
+
+// magic | version | file header with the wrapped data key, then the chunks, the index chunk and the trailer
+static const QByteArray archiveMagic = "HRLA";
+static const quint8 archiveVersion = 2;
+
+// index offset | index size | magic
+static const QByteArray trailerMagic = "HRLAIDX1";
+static const int trailerSize = 8 + 4 + 8;
+
+static const qint64 chunkSize = 1024 * 1024;
+
+static QDataStream& operator<<(QDataStream &stream, const ArchiveEntry &entry)
+{
+    stream << entry.name << entry.size << entry.modified << entry.permissions << static_cast<quint32>(entry.chunks.size());
+    for (const auto &i : entry.chunks)
+        stream << i.offset << i.size;
+
+    return stream;
+}
+
+static QDataStream& operator>>(QDataStream &stream, ArchiveEntry &entry)
+{
+    quint32 chunkCount = 0;
+    stream >> entry.name >> entry.size >> entry.modified >> entry.permissions >> chunkCount;
+    entry.chunks.resize(chunkCount);
+    for (auto &i : entry.chunks)
+        stream >> i.offset >> i.size;
+
+    return stream;
+}
+
+// Only the part of the header that a new password leaves intact is authenticated
+static QByteArray archiveAad(const FileHeader &header)
+{
+    QByteArray aad(archiveMagic);
+    aad.append(static_cast<char>(archiveVersion));
+
+    return (aad + header.aad());
+}
+
+// Every chunk is authenticated together with the archive header, its kind and its own position, so chunks can't be swapped
+static QByteArray chunkAad(const QByteArray &header, const ArchiveEntry::Chunk::Kind kind, const qint64 offset)
+{
+    QByteArray aad(header);
+    aad.append(static_cast<char>(kind));
+    aad.resize(header.size() + 1 + 8);
+    qToBigEndian<qint64>(offset, reinterpret_cast<uchar*>(aad.data() + header.size() + 1));
+
+    return aad;
+}
+
+static int chunkOverhead(const Algorithm algorithm)
+{
+    const auto info = Factory::algorithmInfo(algorithm);
+    Q_ASSERT(Q_NULLPTR != info);
+
+    return (info->ivSize + info->tagSize);
+}
+
+// ArchiveEntry
+
+ArchiveEntry::ArchiveEntry()
+    : size(0)
+    , modified(0)
+    , permissions(0)
+{}
+
+// ArchiveWriter
+
+ArchiveWriter::ArchiveWriter(const QString &fileName)
+    : _file(fileName)
+    , _algorithm(Factory::preferredAlgorithm())
+    , _end(0)
+{}
+
+bool ArchiveWriter::open(const QByteArray &key, QString &errorString)
+{
+    FileHeader header;
+    header.algorithm = _algorithm;
+
+    try {
+        header.iv = Factory::randomBytes(Factory::algorithmInfo(_algorithm)->ivSize);
+        header.setKeyCheck(key);
+
+        // The chunks are encrypted with a key of their own, the password only wraps that key
+        _key = Factory::randomBytes(key.size());
+        header.wrapKey(key, _key);
+    } catch (const Exception &e) {
+        errorString = e.errorMessage();
+
+        return false;
+    }
+
+    _header = archiveAad(header);
+
+    QByteArray data(archiveMagic);
+    data.append(static_cast<char>(archiveVersion));
+    data.append(header.toByteArray());
+
+    if (!_file.open(QFile::WriteOnly) || (_file.write(data) != data.size())) {
+        errorString = _file.errorString();
+
+        return false;
+    }
+
+    _end = data.size();
+
+    return true;
+}
+
+bool ArchiveWriter::addFile(const QString &filePath, const QString &name, const std::atomic_bool &interruptionRequested, const ProgressCallback &progress, QString &errorString)
+{
+    QFile file(filePath);
+    if (!file.open(QFile::ReadOnly)) {
+        errorString = QString("'%1': %2").arg(filePath).arg(file.errorString());
+
+        return false;
+    }
+
+    const QFileInfo fileInfo(file);
+
+    ArchiveEntry entry;
+    entry.name        = name;
+    entry.size        = file.size();
+    entry.modified    = fileInfo.lastModified().toMSecsSinceEpoch();
+    entry.permissions = static_cast<quint32>(file.permissions());
+
+    while (!file.atEnd()) {
+        if (interruptionRequested) {
+            errorString = "Aborted";
+
+            return false;
+        }
+
+        const auto data = file.read(chunkSize);
+        if (data.isEmpty()) {
+            errorString = QString("'%1': %2").arg(filePath).arg(file.errorString());
+
+            return false;
+        }
+
+        ArchiveEntry::Chunk chunk;
+        if (!writeChunk(data, ArchiveEntry::Chunk::Kind::Data, chunk, errorString))
+            return false;
+
+        entry.chunks << chunk;
+        if (progress)
+            progress(data.size());
+    }
+
+    QMutexLocker locker(&_mutex);
+    _entries << entry;
+
+    return true;
+}
+
+bool ArchiveWriter::finish(QString &errorString)
+{
+    QByteArray index;
+    QDataStream stream(&index, QIODevice::WriteOnly);
+    stream << static_cast<quint32>(_entries.size());
+    for (const auto &i : _entries)
+        stream << i;
+
+    ArchiveEntry::Chunk chunk;
+    if (!writeChunk(index, ArchiveEntry::Chunk::Kind::Index, chunk, errorString))
+        return false;
+
+    QByteArray trailer(trailerSize - trailerMagic.size(), 0);
+    qToBigEndian<qint64>(chunk.offset, reinterpret_cast<uchar*>(trailer.data()));
+    qToBigEndian<qint32>(chunk.size, reinterpret_cast<uchar*>(trailer.data() + 8));
+    trailer.append(trailerMagic);
+
+    QMutexLocker locker(&_mutex);
+    if (!_file.seek(_end) || (_file.write(trailer) != trailer.size()) || !_file.flush()) {
+        errorString = _file.errorString();
+
+        return false;
+    }
+
+    _file.close();
+
+    return true;
+}
+
+bool ArchiveWriter::writeChunk(const QByteArray &data, const ArchiveEntry::Chunk::Kind kind, ArchiveEntry::Chunk &chunk, QString &errorString)
+{
+    const auto storedSize = data.size() + chunkOverhead(_algorithm);
+
+    {
+        // Space is claimed first, so that encryption of the chunks runs outside the lock
+        QMutexLocker locker(&_mutex);
+        chunk.offset = _end;
+        chunk.size   = data.size();
+        _end += storedSize;
+    }
+
+    QByteArray stored;
+    try {
+        const auto iv = Factory::randomBytes(Factory::algorithmInfo(_algorithm)->ivSize);
+        auto cipher = Factory::instance().acquireCipher(_key, _algorithm, iv, true);
+        cipher->setAad(chunkAad(_header, kind, chunk.offset));
+        stored = iv;
+        stored += cipher->update(data);
+        stored += cipher->updateFinal();
+        stored += cipher->tag();
+    } catch (const Exception &e) {
+        errorString = e.errorMessage();
+
+        return false;
+    }
+
+    Q_ASSERT(stored.size() == storedSize);
+
+    QMutexLocker locker(&_mutex);
+    if (!_file.seek(chunk.offset) || (_file.write(stored) != stored.size())) {
+        errorString = _file.errorString();
+
+        return false;
+    }
+
+    return true;
+}
+
+// ArchiveReader
+
+ArchiveReader::ArchiveReader(const QString &fileName)
+    : _file(fileName)
+    , _algorithm(Algorithm::Aes256Gcm)
+{}
+
+bool ArchiveReader::open(const QVector<QByteArray> &keys, QString &errorString)
+{
+    if (!_file.open(QFile::ReadOnly)) {
+        errorString = _file.errorString();
+
+        return false;
+    }
+
+    FileHeader header;
+    const auto fixed = _file.read(archiveMagic.size() + 1);
+    if ((fixed.size() != archiveMagic.size() + 1) || !fixed.startsWith(archiveMagic) || (static_cast<quint8>(fixed.at(archiveMagic.size())) != archiveVersion)
+        || !FileHeader::hasMagic(_file) || !header.read(_file)) {
+        errorString = "Unsupported file format";
+
+        return false;
+    }
+
+    _algorithm = header.algorithm;
+    const auto info = Factory::algorithmInfo(_algorithm);
+    if ((Q_NULLPTR == info) || (0 == info->tagSize)) {
+        errorString = "Unsupported cipher";
+
+        return false;
+    }
+
+    try {
+        const auto key = std::find_if(keys.cbegin(), keys.cend(), [&header] (const QByteArray &i) { return header.checkKey(i); });
+        if (keys.cend() == key) {
+            errorString = "Wrong password";
+
+            return false;
+        }
+
+        _key = header.unwrapKey(*key);
+    } catch (const Exception &e) {
+        errorString = e.errorMessage();
+
+        return false;
+    }
+
+    _header = archiveAad(header);
+
+    if ((_file.size() < _file.pos() + trailerSize) || !_file.seek(_file.size() - trailerSize)) {
+        errorString = "The file is truncated";
+
+        return false;
+    }
+
+    const auto trailer = _file.read(trailerSize);
+    if ((trailer.size() != trailerSize) || !trailer.endsWith(trailerMagic)) {
+        errorString = "The archive index is missing";
+
+        return false;
+    }
+
+    ArchiveEntry::Chunk chunk;
+    chunk.offset = qFromBigEndian<qint64>(reinterpret_cast<const uchar*>(trailer.constData()));
+    chunk.size   = qFromBigEndian<qint32>(reinterpret_cast<const uchar*>(trailer.constData() + 8));
+
+    QByteArray index;
+    if (!readChunk(chunk, ArchiveEntry::Chunk::Kind::Index, index, errorString))
+        return false;
+
+    QDataStream stream(index);
+    quint32 entryCount = 0;
+    stream >> entryCount;
+    _entries.resize(entryCount);
+    for (auto i = 0; i < _entries.size(); ++i) {
+        stream >> _entries[i];
+        _indexes.insert(_entries.at(i).name, i);
+    }
+
+    if (QDataStream::Ok != stream.status()) {
+        errorString = "The archive index is corrupted";
+
+        return false;
+    }
+
+    return true;
+}
+
+qint64 ArchiveReader::keyHeaderOffset(QIODevice &device)
+{
+    QByteArray prefix(archiveMagic);
+    prefix.append(static_cast<char>(archiveVersion));
+
+    return ((device.peek(prefix.size()) == prefix) ? prefix.size() : -1);
+}
+
+bool ArchiveReader::extract(const ArchiveEntry &entry, const QString &folder, const std::atomic_bool &interruptionRequested, const ArchiveWriter::ProgressCallback &progress, QString &errorString)
+{
+    // Names come from the archive, they must not escape the destination folder
+    const auto name = QDir::cleanPath(entry.name);
+    if (name.isEmpty() || QDir::isAbsolutePath(name) || (".." == name) || name.startsWith("../")) {
+        errorString = QString("'%1': Invalid entry name").arg(entry.name);
+
+        return false;
+    }
+
+    const auto filePath = QDir(folder).filePath(name);
+    if (!QDir().mkpath(QFileInfo(filePath).absolutePath())) {
+        errorString = QString("'%1': Unable to create the folder").arg(QFileInfo(filePath).absolutePath());
+
+        return false;
+    }
+
+    QFile file(filePath);
+    if (!file.open(QFile::WriteOnly | QFile::NewOnly)) {
+        errorString = QString("'%1': %2").arg(filePath).arg(file.errorString());
+
+        return false;
+    }
+
+    auto failExtraction = [&file] () {
+        file.close();
+        file.remove();
+
+        return false;
+    };
+
+    QByteArray data;
+    for (const auto &i : entry.chunks) {
+        if (interruptionRequested) {
+            errorString = "Aborted";
+
+            return failExtraction();
+        }
+
+        if (!readChunk(i, ArchiveEntry::Chunk::Kind::Data, data, errorString))
+            return failExtraction();
+
+        if (file.write(data) != data.size()) {
+            errorString = QString("'%1': %2").arg(filePath).arg(file.errorString());
+
+            return failExtraction();
+        }
+
+        if (progress)
+            progress(data.size());
+    }
+
+    file.setPermissions(static_cast<QFile::Permissions>(entry.permissions));
+    file.setFileTime(QDateTime::fromMSecsSinceEpoch(entry.modified), QFileDevice::FileModificationTime);
+
+    return true;
+}
+
+bool ArchiveReader::readChunk(const ArchiveEntry::Chunk &chunk, const ArchiveEntry::Chunk::Kind kind, QByteArray &data, QString &errorString)
+{
+    const auto info = Factory::algorithmInfo(_algorithm);
+    Q_ASSERT(Q_NULLPTR != info);
+
+    QByteArray stored;
+    {
+        QMutexLocker locker(&_mutex);
+        if ((chunk.size < 0) || !_file.seek(chunk.offset))
+            stored.clear();
+        else
+            stored = _file.read(chunk.size + chunkOverhead(_algorithm));
+    }
+
+    if (stored.size() != chunk.size + chunkOverhead(_algorithm)) {
+        errorString = "The file is truncated";
+
+        return false;
+    }
+
+    try {
+        auto cipher = Factory::instance().acquireCipher(_key, _algorithm, stored.left(info->ivSize), false);
+        cipher->setTag(stored.right(info->tagSize));
+        cipher->setAad(chunkAad(_header, kind, chunk.offset));
+        data = cipher->update(stored.mid(info->ivSize, chunk.size));
+        data += cipher->updateFinal();
+    } catch (const Exception &e) {
+        errorString = e.errorMessage();
+
+        return false;
+    }
+
+    return true;
+}
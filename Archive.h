@@ -0,0 +1,96 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QVector>
+
+#include <atomic>
+#include <functional>
+
+#include "Crypto.h"
+
+// ArchiveEntry
+struct ArchiveEntry
+{
+    struct Chunk {
+        // Bound into the authentication of every chunk, so a data chunk is never accepted as the index
+        enum class Kind : quint8 {
+            Data,
+            Index
+        };
+
+        qint64 offset;
+        qint32 size;
+    };
+
+    ArchiveEntry();
+
+    QString name;
+    qint64 size;
+    qint64 modified;
+    quint32 permissions;
+    QVector<ArchiveEntry::Chunk> chunks;
+};
+
+// ArchiveWriter
+class ArchiveWriter
+{
+    Q_DISABLE_COPY(ArchiveWriter)
+
+public:
+    using ProgressCallback = std::function<void(qint64)>;
+
+    explicit ArchiveWriter(const QString &fileName);
+
+    bool open(const QByteArray &key, QString &errorString);
+    // Files may be added from several threads at once, they are encrypted in parallel and appended in turn
+    bool addFile(const QString &filePath, const QString &name, const std::atomic_bool &interruptionRequested, const ProgressCallback &progress, QString &errorString);
+    bool finish(QString &errorString);
+
+private:
+    bool writeChunk(const QByteArray &data, const ArchiveEntry::Chunk::Kind kind, ArchiveEntry::Chunk &chunk, QString &errorString);
+
+    QFile _file;
+    QByteArray _key;
+    QByteArray _header;
+    Crypto::Algorithm _algorithm;
+    QMutex _mutex;
+    qint64 _end;
+    QVector<ArchiveEntry> _entries;
+};
+
+// ArchiveReader
+class ArchiveReader
+{
+    Q_DISABLE_COPY(ArchiveReader)
+
+public:
+    explicit ArchiveReader(const QString &fileName);
+
+    // The archive is unlocked with the first of the keys it accepts
+    bool open(const QVector<QByteArray> &keys, QString &errorString);
+
+    // The file header with the wrapped key follows the magic and the version, -1 if the device isn't an archive
+    static qint64 keyHeaderOffset(QIODevice &device);
+
+    const QVector<ArchiveEntry>& entries() const { return _entries; }
+    int indexOf(const QString &name) const { return _indexes.value(name, -1); }
+
+    // Only the chunks of the entry are read and decrypted; safe to call from several threads at once
+    bool extract(const ArchiveEntry &entry, const QString &folder, const std::atomic_bool &interruptionRequested, const ArchiveWriter::ProgressCallback &progress, QString &errorString);
+
+private:
+    bool readChunk(const ArchiveEntry::Chunk &chunk, const ArchiveEntry::Chunk::Kind kind, QByteArray &data, QString &errorString);
+
+    QFile _file;
+    QByteArray _key;
+    QByteArray _header;
+    Crypto::Algorithm _algorithm;
+    QMutex _mutex;
+    QVector<ArchiveEntry> _entries;
+    QHash<QString, int> _indexes;
+};
+
+#endif // ARCHIVE_H
@@ -0,0 +1,207 @@
+#include "BufferPool.h"
+
+#include <QThread>
+
+#ifdef Q_OS_LINUX
+#include <sched.h>
+#endif
+
+#include "IoBackend.h"
+#include "Settings.h"
+#include "Utils.h"
+
+namespace
+{
+    const qint64 bufferAlignment = 4096;
+    const int waitSlice = 100;
+
+    // A free list head keeps the index of the top buffer plus one in the low half
+    // and a counter in the high half, which makes a head that was popped and pushed back compare unequal
+    const quint64 indexMask = 0xffffffffu;
+
+    quint64 makeHead(const quint64 head, const quint32 top)
+    {
+        return ((((head >> 32) + 1) << 32) | top);
+    }
+}
+
+// BufferLease
+
+BufferLease::BufferLease()
+    : _index(-1)
+{}
+
+BufferLease::BufferLease(const int index)
+    : _index(index)
+{}
+
+BufferLease::BufferLease(BufferLease &&other)
+    : _index(other._index)
+{
+    other._index = -1;
+}
+
+BufferLease::~BufferLease()
+{
+    release();
+}
+
+BufferLease& BufferLease::operator=(BufferLease &&other)
+{
+    if (&other != this) {
+        release();
+        _index = other._index;
+        other._index = -1;
+    }
+
+    return (*this);
+}
+
+char* BufferLease::input() const
+{
+    Q_ASSERT(_index >= 0);
+
+    return BufferPool::instance()._buffers[_index].data;
+}
+
+char* BufferLease::output() const
+{
+    Q_ASSERT(_index >= 0);
+
+    return (BufferPool::instance()._buffers[_index].data + IoBackend::chunkSize);
+}
+
+void BufferLease::release()
+{
+    if (_index >= 0) {
+        BufferPool::instance().release(_index);
+        _index = -1;
+    }
+}
+
+// BufferPool
+
+// The cipher's output may be a block longer than its input, the rest keeps the next buffer aligned
+const qint64 BufferPool::bufferSize = 2 * IoBackend::chunkSize + bufferAlignment;
+
+BufferPool::BufferPool()
+    : _capacity(qMax(1, static_cast<int>(static_cast<qint64>(Settings::instance().bufferMemory()) * 1024 * 1024 / bufferSize)))
+    , _buffers(new Buffer[_capacity])
+    , _allocated(0)
+    , _nodeCount(0)
+    , _available(_capacity)
+{
+    const auto nodes = Utils::cpuNodes();
+    _nodeCount = nodes.size();
+    for (auto node = 0; node < nodes.size(); ++node) {
+        for (auto cpu : nodes.at(node)) {
+            if (cpu >= _cpuNodes.size())
+                _cpuNodes.resize(cpu + 1);
+            _cpuNodes[cpu] = node;
+        }
+    }
+
+    _freeLists.reset(new std::atomic<quint64>[_nodeCount]);
+    for (auto i = 0; i < _nodeCount; ++i)
+        _freeLists[i] = 0;
+}
+
+BufferPool& BufferPool::instance()
+{
+    // Never destroyed: worker threads may still return their buffers while the program exits
+    static auto instance = new BufferPool();
+
+    return (*instance);
+}
+
+BufferLease BufferPool::acquire(const std::atomic_bool &interruptionRequested)
+{
+    // Every permit stands for a buffer that is either free or not allocated yet; the buffers may all be
+    // held by paused jobs, so the wait is cut into slices to let the job be stopped meanwhile
+    while (!_available.tryAcquire(1, waitSlice)) {
+        if (interruptionRequested)
+            return BufferLease();
+    }
+
+    return take();
+}
+
+BufferLease BufferPool::tryAcquire()
+{
+    if (!_available.tryAcquire())
+        return BufferLease();
+
+    return take();
+}
+
+BufferLease BufferPool::take()
+{
+    const auto node = currentNode();
+    for (;;) {
+        auto index = pop(_freeLists[node]);
+        if (index >= 0)
+            return BufferLease(index);
+
+        auto allocated = _allocated.load();
+        while (allocated < _capacity) {
+            if (_allocated.compare_exchange_weak(allocated, allocated + 1)) {
+                auto &buffer = _buffers[allocated];
+                buffer.data = static_cast<char*>(qMallocAligned(bufferSize, bufferAlignment));
+                Q_CHECK_PTR(buffer.data);
+                buffer.node = node;
+
+                return BufferLease(allocated);
+            }
+        }
+
+        // Everything is allocated, so a buffer of another node has to do
+        for (auto i = 1; i < _nodeCount; ++i) {
+            index = pop(_freeLists[(node + i) % _nodeCount]);
+            if (index >= 0)
+                return BufferLease(index);
+        }
+
+        // The buffer that belongs to the permit is being pushed back right now
+        QThread::yieldCurrentThread();
+    }
+}
+
+int BufferPool::currentNode() const
+{
+#ifdef Q_OS_LINUX
+    const auto cpu = ::sched_getcpu();
+    if ((cpu >= 0) && (cpu < _cpuNodes.size()))
+        return _cpuNodes.at(cpu);
+#endif
+
+    return 0;
+}
+
+int BufferPool::pop(std::atomic<quint64> &freeList)
+{
+    auto head = freeList.load(std::memory_order_acquire);
+    while (0 != (head & indexMask)) {
+        const auto index = static_cast<int>((head & indexMask) - 1);
+        const auto next = makeHead(head, _buffers[index].next.load(std::memory_order_relaxed));
+        if (freeList.compare_exchange_weak(head, next, std::memory_order_acq_rel, std::memory_order_acquire))
+            return index;
+    }
+
+    return -1;
+}
+
+void BufferPool::push(std::atomic<quint64> &freeList, const int index)
+{
+    auto head = freeList.load(std::memory_order_relaxed);
+    quint64 next = 0;
+    do {
+        _buffers[index].next.store(static_cast<quint32>(head & indexMask), std::memory_order_relaxed);
+        next = makeHead(head, static_cast<quint32>(index + 1));
+    } while (!freeList.compare_exchange_weak(head, next, std::memory_order_release, std::memory_order_relaxed));
+}
+
+void BufferPool::release(const int index)
+{
+    push(_freeLists[_buffers[index].node], index);
+    _available.release();
+}
@@ -0,0 +1,85 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <QSemaphore>
+#include <QVector>
+
+#include <atomic>
+#include <memory>
+
+// BufferLease
+class BufferLease
+{
+    Q_DISABLE_COPY(BufferLease)
+
+    friend class BufferPool;
+
+private:
+    explicit BufferLease(const int index);
+
+public:
+    BufferLease();
+    BufferLease(BufferLease &&other);
+    ~BufferLease();
+
+    BufferLease& operator=(BufferLease &&other);
+
+    explicit operator bool() const { return (_index >= 0); }
+    // A chunk of IoBackend::chunkSize bytes is read into the input, the cipher writes to the output
+    char* input() const;
+    char* output() const;
+
+private:
+    void release();
+
+    int _index;
+};
+
+// BufferPool
+class BufferPool
+{
+    Q_DISABLE_COPY(BufferPool)
+
+    friend class BufferLease;
+
+private:
+    BufferPool();
+    ~BufferPool() {}
+
+public:
+    static const qint64 bufferSize;
+
+    static BufferPool& instance();
+
+    int capacity() const { return _capacity; }
+
+    // Waits while all the buffers allowed by the memory limit are in use, an interrupted wait returns an empty lease
+    BufferLease acquire(const std::atomic_bool &interruptionRequested);
+    // Returns an empty lease rather than waiting
+    BufferLease tryAcquire();
+
+private:
+    struct Buffer {
+        char *data;
+        int node;
+        std::atomic<quint32> next;
+    };
+
+    BufferLease take();
+    int currentNode() const;
+    int pop(std::atomic<quint64> &freeList);
+    void push(std::atomic<quint64> &freeList, const int index);
+    void release(const int index);
+
+    // Buffers are allocated on demand up to the limit and never freed;
+    // every NUMA node has its own free list so that a buffer is reused on the node that touched it first
+    const int _capacity;
+    std::unique_ptr<Buffer[]> _buffers;
+    std::atomic_int _allocated;
+    QVector<int> _cpuNodes;
+    int _nodeCount;
+    std::unique_ptr<std::atomic<quint64>[]> _freeLists;
+    QSemaphore _available;
+};
+
+#endif // BUFFERPOOL_H
@@ -0,0 +1,399 @@
+#include "ChunkStore.h"
+
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QTemporaryFile>
+
+#include "Crypto.h"
+#include "FileHeader.h"
+#include "Utils.h"
+
+#include <algorithm>
+
+using namespace Crypto;
+
+static const int idSize = 32;
+static const quint32 listVersion = 1;
+
+// ChunkStore
+
+ChunkStore::ChunkStore(const QString &folder)
+    : _folder(folder)
+{}
+
+QString ChunkStore::defaultFolder()
+{
+    return QDir(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation)).filePath("chunks");
+}
+
+QString ChunkStore::keyFileName(const QString &folder)
+{
+    return QDir(folder).filePath("key");
+}
+
+bool ChunkStore::open(const QVector<QByteArray> &keys, const bool create, QString &errorString)
+{
+    Q_ASSERT(!keys.isEmpty());
+
+    _keys = keys;
+
+    const auto fileName = keyFileName(_folder);
+    if (QFile::exists(fileName))
+        return loadKey(fileName, errorString);
+
+    if (!create) {
+        errorString = QString("'%1': The chunk store has no key").arg(fileName);
+
+        return false;
+    }
+
+    return createKey(errorString);
+}
+
+bool ChunkStore::put(const QByteArray &data, ChunkStore::Reference &reference, bool &written, QString &errorString)
+{
+    written = false;
+
+    try {
+        // The id is keyed, so the store doesn't reveal which well-known contents it holds
+        auto &signer = Factory::instance().localSigner(_storeKey);
+        signer.update(data);
+        reference.id   = signer.updateFinal().left(idSize);
+        reference.size = data.size();
+
+        const auto fileName = chunkFileName(reference.id);
+        if (QFile::exists(fileName))
+            return true;
+
+        // Every key encrypts a single plaintext, so a fixed IV is safe and keeps the ciphertext deterministic
+        const auto algorithm = Factory::preferredAlgorithm();
+        const auto info = Factory::algorithmInfo(algorithm);
+        auto cipher = Factory::instance().acquireCipher(chunkKey(reference.id), algorithm, QByteArray(info->ivSize, 0), true);
+        cipher->setAad(reference.id);
+
+        QByteArray chunk(1, static_cast<char>(algorithm));
+        chunk += cipher->update(data);
+        chunk += cipher->updateFinal();
+        chunk += cipher->tag();
+
+        if (!QDir().mkpath(QFileInfo(fileName).absolutePath())) {
+            errorString = QString("'%1': Unable to create the folder").arg(QFileInfo(fileName).absolutePath());
+
+            return false;
+        }
+
+        // Concurrent writers of the same chunk produce the same bytes, whichever rename lands last is fine
+        QSaveFile file(fileName);
+        if (!file.open(QFile::WriteOnly) || (file.write(chunk) != chunk.size()) || !file.commit()) {
+            errorString = QString("'%1': %2").arg(fileName).arg(file.errorString());
+
+            return false;
+        }
+
+        _unsyncedFolders.insert(QFileInfo(fileName).absolutePath());
+    } catch (const Exception &e) {
+        errorString = e.errorMessage();
+
+        return false;
+    }
+
+    written = true;
+
+    return true;
+}
+
+bool ChunkStore::get(const ChunkStore::Reference &reference, QByteArray &data, QString &errorString) const
+{
+    const auto fileName = chunkFileName(reference.id);
+
+    QFile file(fileName);
+    if (!file.open(QFile::ReadOnly)) {
+        errorString = QString("'%1': %2").arg(fileName).arg(file.errorString());
+
+        return false;
+    }
+
+    const auto chunk = file.readAll();
+    const auto info = chunk.isEmpty() ? Q_NULLPTR : Factory::algorithmInfo(static_cast<Algorithm>(chunk.at(0)));
+    if ((Q_NULLPTR == info) || (0 == info->tagSize) || (chunk.size() != 1 + reference.size + info->tagSize)) {
+        errorString = QString("'%1': The chunk is corrupted").arg(fileName);
+
+        return false;
+    }
+
+    try {
+        auto cipher = Factory::instance().acquireCipher(chunkKey(reference.id), info->algorithm, QByteArray(info->ivSize, 0), false);
+        cipher->setAad(reference.id);
+        cipher->setTag(chunk.right(info->tagSize));
+        data = cipher->update(chunk.mid(1, reference.size));
+        data += cipher->updateFinal();
+    } catch (const Exception &e) {
+        errorString = QString("'%1': %2").arg(fileName).arg(e.errorMessage());
+
+        return false;
+    }
+
+    return true;
+}
+
+bool ChunkStore::sync(QString &errorString)
+{
+    // New subfolders are entries of the store folder
+    if (!_unsyncedFolders.isEmpty())
+        _unsyncedFolders.insert(_folder);
+
+    for (const auto &i : _unsyncedFolders) {
+        if (!Utils::syncFolder(i)) {
+            errorString = QString("'%1': Unable to sync the folder").arg(i);
+
+            return false;
+        }
+    }
+    _unsyncedFolders.clear();
+
+    return true;
+}
+
+bool ChunkStore::saveList(const QString &fileName, const QVector<ChunkStore::Reference> &references, QString &errorString) const
+{
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream << listVersion << static_cast<quint32>(references.size());
+    for (const auto &i : references)
+        stream << i.id << i.size;
+
+    QFile file(fileName);
+    if (!file.open(QFile::WriteOnly)) {
+        errorString = file.errorString();
+
+        return false;
+    }
+
+    try {
+        FileHeader header;
+        header.algorithm = Factory::preferredAlgorithm();
+        header.iv        = Factory::randomBytes(Factory::algorithmInfo(header.algorithm)->ivSize);
+        header.setKeyCheck(_keys.first());
+
+        const auto dataKey = Factory::randomBytes(_keys.first().size());
+        header.wrapKey(_keys.first(), dataKey);
+
+        const auto headerData = header.toByteArray();
+        auto cipher = Factory::instance().acquireCipher(dataKey, header.algorithm, header.iv, true);
+        cipher->setAad(header.aad());
+
+        auto data = headerData;
+        data += cipher->update(payload);
+        data += cipher->updateFinal();
+        data += cipher->tag();
+
+        if ((file.write(data) != data.size()) || !Utils::syncFile(file)) {
+            errorString = file.errorString();
+
+            return false;
+        }
+    } catch (const Exception &e) {
+        errorString = e.errorMessage();
+
+        return false;
+    }
+
+    return true;
+}
+
+bool ChunkStore::loadList(const QString &fileName, QVector<ChunkStore::Reference> &references, QString &errorString) const
+{
+    QFile file(fileName);
+    if (!file.open(QFile::ReadOnly)) {
+        errorString = file.errorString();
+
+        return false;
+    }
+
+    FileHeader header;
+    if (!FileHeader::hasMagic(file) || !header.read(file)) {
+        errorString = "Unsupported file format";
+
+        return false;
+    }
+
+    QByteArray key;
+    try {
+        const auto i = std::find_if(_keys.cbegin(), _keys.cend(), [&header] (const QByteArray &key) { return header.checkKey(key); });
+        if (_keys.cend() == i) {
+            errorString = "Wrong password";
+
+            return false;
+        }
+
+        key = *i;
+    } catch (const Exception &e) {
+        errorString = e.errorMessage();
+
+        return false;
+    }
+
+    const auto info = Factory::algorithmInfo(header.algorithm);
+    if ((Q_NULLPTR == info) || (0 == info->tagSize)) {
+        errorString = "Unsupported cipher";
+
+        return false;
+    }
+
+    const auto data = file.readAll();
+    if (data.size() < info->tagSize) {
+        errorString = "The file is truncated";
+
+        return false;
+    }
+
+    QByteArray payload;
+    try {
+        const auto dataKey = header.unwrapKey(key);
+        auto cipher = Factory::instance().acquireCipher(dataKey, header.algorithm, header.iv, false);
+        cipher->setTag(data.right(info->tagSize));
+        cipher->setAad(header.aad());
+        payload = cipher->update(data.left(data.size() - info->tagSize));
+        payload += cipher->updateFinal();
+    } catch (const Exception &e) {
+        errorString = e.errorMessage();
+
+        return false;
+    }
+
+    QDataStream stream(payload);
+    quint32 version = 0, count = 0;
+    stream >> version >> count;
+    if (listVersion != version) {
+        errorString = "Unsupported file format";
+
+        return false;
+    }
+
+    references.resize(count);
+    for (auto &i : references)
+        stream >> i.id >> i.size;
+
+    if ((QDataStream::Ok != stream.status()) || !std::all_of(references.cbegin(), references.cend(), [] (const ChunkStore::Reference &reference) { return (idSize == reference.id.size()) && (reference.size >= 0); })) {
+        errorString = "The chunk list is corrupted";
+
+        return false;
+    }
+
+    return true;
+}
+
+bool ChunkStore::loadKey(const QString &fileName, QString &errorString)
+{
+    QFile file(fileName);
+    if (!file.open(QFile::ReadOnly)) {
+        errorString = QString("'%1': %2").arg(fileName).arg(file.errorString());
+
+        return false;
+    }
+
+    FileHeader header;
+    if (!FileHeader::hasMagic(file) || !header.read(file)) {
+        errorString = QString("'%1': Unsupported file format").arg(fileName);
+
+        return false;
+    }
+
+    try {
+        const auto i = std::find_if(_keys.cbegin(), _keys.cend(), [&header] (const QByteArray &key) { return header.checkKey(key); });
+        if (_keys.cend() == i) {
+            errorString = QString("'%1': Wrong password").arg(fileName);
+
+            return false;
+        }
+
+        _storeKey = header.unwrapKey(*i);
+    } catch (const Exception &e) {
+        errorString = QString("'%1': %2").arg(fileName).arg(e.errorMessage());
+
+        return false;
+    }
+
+    return true;
+}
+
+bool ChunkStore::createKey(QString &errorString)
+{
+    // Jobs of this process wait for each other, another process that wins the race simply has its key loaded
+    static QMutex mutex;
+    QMutexLocker locker(&mutex);
+
+    const auto fileName = keyFileName(_folder);
+    if (QFile::exists(fileName))
+        return loadKey(fileName, errorString);
+
+    if (!QDir().mkpath(_folder)) {
+        errorString = QString("'%1': Unable to create the folder").arg(_folder);
+
+        return false;
+    }
+
+    QByteArray data;
+    QByteArray storeKey;
+    try {
+        FileHeader header;
+        header.algorithm = Factory::preferredAlgorithm();
+        header.iv        = Factory::randomBytes(Factory::algorithmInfo(header.algorithm)->ivSize);
+        header.setKeyCheck(_keys.first());
+
+        storeKey = Factory::randomBytes(_keys.first().size());
+        header.wrapKey(_keys.first(), storeKey);
+        data = header.toByteArray();
+    } catch (const Exception &e) {
+        errorString = e.errorMessage();
+
+        return false;
+    }
+
+    // The key file is complete and durable before it appears, and an existing one is never replaced
+    QTemporaryFile file(QDir(_folder).filePath("key-XXXXXX"));
+    if (!file.open() || (file.write(data) != data.size()) || !Utils::syncFile(file)) {
+        errorString = QString("'%1': %2").arg(file.fileName()).arg(file.errorString());
+
+        return false;
+    }
+
+    file.close();
+    if (!QFile::rename(file.fileName(), fileName)) {
+        if (QFile::exists(fileName))
+            return loadKey(fileName, errorString);
+
+        errorString = QString("'%1': Unable to create the key file").arg(fileName);
+
+        return false;
+    }
+
+    file.setAutoRemove(false);
+    if (!Utils::syncFolder(_folder)) {
+        errorString = QString("'%1': Unable to sync the folder").arg(_folder);
+
+        return false;
+    }
+
+    _storeKey = storeKey;
+
+    return true;
+}
+
+QString ChunkStore::chunkFileName(const QByteArray &id) const
+{
+    // Two levels of fan-out keep directories small even with millions of chunks
+    const auto hex = QString::fromLatin1(id.toHex());
+
+    return QString("%1/%2/%3/%4").arg(_folder).arg(hex.left(2)).arg(hex.mid(2, 2)).arg(hex.mid(4));
+}
+
+QByteArray ChunkStore::chunkKey(const QByteArray &id) const
+{
+    return Factory::hash(_storeKey + id, Factory::SHA::SHA256);
+}
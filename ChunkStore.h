@@ -0,0 +1,54 @@
+#ifndef CHUNKSTORE_H
+#define CHUNKSTORE_H
+
+#include <QByteArray>
+#include <QSet>
+#include <QString>
+#include <QVector>
+
+// ChunkStore
+class ChunkStore
+{
+    Q_DISABLE_COPY(ChunkStore)
+
+public:
+    struct Reference {
+        QByteArray id;
+        qint32 size;
+    };
+
+    explicit ChunkStore(const QString &folder);
+
+    static QString defaultFolder();
+    // The key file holds the store key wrapped with the password, new passwords only rewrap it
+    static QString keyFileName(const QString &folder);
+
+    const QString& folder() const { return _folder; }
+
+    // Unlocks the store with the first of the keys it accepts; new chunk lists are wrapped with the first key
+    bool open(const QVector<QByteArray> &keys, const bool create, QString &errorString);
+
+    // Identical chunks get identical ids and ciphertexts, so a chunk that is already stored is not written again
+    bool put(const QByteArray &data, ChunkStore::Reference &reference, bool &written, QString &errorString);
+    bool get(const ChunkStore::Reference &reference, QByteArray &data, QString &errorString) const;
+    // The chunks themselves are synced when written, this makes their names durable
+    bool sync(QString &errorString);
+
+    // A chunk list is an ordinary encrypted file whose payload is the list of references
+    bool saveList(const QString &fileName, const QVector<ChunkStore::Reference> &references, QString &errorString) const;
+    bool loadList(const QString &fileName, QVector<ChunkStore::Reference> &references, QString &errorString) const;
+
+private:
+    bool loadKey(const QString &fileName, QString &errorString);
+    bool createKey(QString &errorString);
+
+    QString chunkFileName(const QByteArray &id) const;
+    QByteArray chunkKey(const QByteArray &id) const;
+
+    const QString _folder;
+    QVector<QByteArray> _keys;
+    QByteArray _storeKey;
+    QSet<QString> _unsyncedFolders;
+};
+
+#endif // CHUNKSTORE_H
@@ -0,0 +1,57 @@
+#include "Chunker.h"
+
+#include <algorithm>
+
+namespace
+{
+    // Normalized chunking: a stricter mask below the average size and a looser one above it
+    // pulls chunk sizes towards the average
+    const quint64 maskSmall = Q_UINT64_C(0x0074d50931d20000); // 18 bits
+    const quint64 maskLarge = Q_UINT64_C(0x0838911260430000); // 14 bits
+
+    struct GearTable {
+        quint64 values[256];
+
+        GearTable()
+        {
+            // The table must never change, or stored chunks would stop matching: splitmix64 from a fixed seed
+            quint64 state = Q_UINT64_C(0x486172616c756721);
+            for (auto &i : values) {
+                auto z = (state += Q_UINT64_C(0x9e3779b97f4a7c15));
+                z = (z ^ (z >> 30)) * Q_UINT64_C(0xbf58476d1ce4e5b9);
+                z = (z ^ (z >> 27)) * Q_UINT64_C(0x94d049bb133111eb);
+                i = z ^ (z >> 31);
+            }
+        }
+    };
+
+    const GearTable gearTable;
+}
+
+// Chunker
+
+int Chunker::cut(const uchar *data, const int length)
+{
+    if (length <= minSize)
+        return length;
+
+    const auto end = std::min(length, maxSize);
+    const auto normal = std::min(averageSize, end);
+
+    // Nothing before minSize can be a cut point, so hashing starts right there
+    quint64 hash = 0;
+    auto i = minSize;
+    for (; i < normal; ++i) {
+        hash = (hash << 1) + gearTable.values[data[i]];
+        if (0 == (hash & maskSmall))
+            return (i + 1);
+    }
+
+    for (; i < end; ++i) {
+        hash = (hash << 1) + gearTable.values[data[i]];
+        if (0 == (hash & maskLarge))
+            return (i + 1);
+    }
+
+    return end;
+}
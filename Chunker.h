@@ -0,0 +1,25 @@
+#ifndef CHUNKER_H
+#define CHUNKER_H
+
+#include <QtGlobal>
+
+// Chunker
+class Chunker
+{
+    Q_DISABLE_COPY(Chunker)
+
+private:
+    Chunker() {}
+    virtual ~Chunker() {}
+
+public:
+    static const int minSize     = 16 * 1024;
+    static const int averageSize = 64 * 1024;
+    static const int maxSize     = 256 * 1024;
+
+    // Content-defined (FastCDC) cut point: the length of the first chunk of data.
+    // Unless data holds the end of the input, it has to hold at least maxSize bytes.
+    static int cut(const uchar *data, const int length);
+};
+
+#endif // CHUNKER_H
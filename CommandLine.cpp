@@ -0,0 +1,393 @@
+#include "CommandLine.h"
+
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QTextStream>
+#include <QtConcurrent>
+
+#include "Archive.h"
+#include "ChunkStore.h"
+#include "Crypto.h"
+#include "PasswordGenerator.h"
+#include "Rekey.h"
+#include "Settings.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <numeric>
+
+namespace
+{
+    const char *generateOption = "generate";
+    const char *listOption     = "list";
+    const char *extractOption  = "extract";
+    const char *rekeyOption    = "rekey";
+    const char *testOption     = "test";
+
+    // Passwords are produced and written in slices so that millions of them don't have to fit in memory at once
+    const int sliceSize = 65536;
+
+    bool readWords(const QString &fileName, QStringList &words, QString &errorString)
+    {
+        QFile file(fileName);
+        if (!file.open(QFile::ReadOnly | QFile::Text)) {
+            errorString = file.errorString();
+            return false;
+        }
+
+        QTextStream stream(&file);
+        while (!stream.atEnd()) {
+            // Diceware lists prefix every word with its dice roll, keep only the last column
+            const auto word = stream.readLine().simplified().section(' ', -1);
+            if (!word.isEmpty())
+                words << word;
+        }
+
+        if (words.isEmpty()) {
+            errorString = QObject::tr("The word list is empty");
+            return false;
+        }
+
+        return true;
+    }
+
+    bool readPassword(const QString &fileName, QString &password, QString &errorString)
+    {
+        QByteArray line;
+        if ("-" == fileName) {
+            // Read line by line from stdin, so that an old and a new password can both be piped in
+            std::string input;
+            if (!std::getline(std::cin, input)) {
+                errorString = QObject::tr("Unable to read the password");
+                return false;
+            }
+            line = QByteArray::fromStdString(input);
+        } else {
+            QFile file(fileName);
+            if (!file.open(QFile::ReadOnly)) {
+                errorString = QString("'%1': %2").arg(fileName).arg(file.errorString());
+                return false;
+            }
+            line = file.readLine();
+        }
+
+        while (line.endsWith('\n') || line.endsWith('\r'))
+            line.chop(1);
+
+        password = QString::fromUtf8(line);
+        if (password.isEmpty()) {
+            errorString = QObject::tr("The password shouldn't be empty");
+            return false;
+        }
+
+        return true;
+    }
+
+    bool usePassword(const QString &fileName, QString &errorString)
+    {
+        QString password;
+        if (!readPassword(fileName, password, errorString))
+            return false;
+
+        if (!Settings::instance().setPassword(password)) {
+            errorString = QObject::tr("Unable to derive the key");
+            return false;
+        }
+
+        return true;
+    }
+}
+
+// CommandLine
+
+bool CommandLine::isBatchMode(int argc, char *argv[])
+{
+    for (auto i = 1; i < argc; ++i) {
+        const auto argument = argv[i];
+        for (const auto option : { generateOption, listOption, extractOption, rekeyOption, testOption }) {
+            const auto length = std::strlen(option);
+            if ((0 == std::strncmp(argument, "--", 2)) && (0 == std::strncmp(argument + 2, option, length))
+                && (('\0' == argument[2 + length]) || ('=' == argument[2 + length])))
+                return true;
+        }
+    }
+
+    return false;
+}
+
+int CommandLine::exec(const QStringList &arguments)
+{
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    parser.addOptions({
+        { generateOption, QObject::tr("Print <count> random passwords and exit."), "count" },
+        { "length", QObject::tr("Password length (default 16)."), "length", "16" },
+        { "digits", QObject::tr("Use digits.") },
+        { "minus", QObject::tr("Use the minus sign.") },
+        { "underline", QObject::tr("Use the underline.") },
+        { "space", QObject::tr("Use the space.") },
+        { "special", QObject::tr("Use special symbols.") },
+        { "brackets", QObject::tr("Use brackets.") },
+        { "passphrase", QObject::tr("Print passphrases built from the words in <file> instead."), "file" },
+        { "words", QObject::tr("Words per passphrase (default 6)."), "count", "6" },
+        { "separator", QObject::tr("Passphrase word separator (default space)."), "separator", " " },
+        { listOption, QObject::tr("List the files stored in <archive> and exit."), "archive" },
+        { extractOption, QObject::tr("Extract files from <archive> and exit."), "archive" },
+        { "entry", QObject::tr("Extract only <name>, may be repeated."), "name" },
+        { "output", QObject::tr("Extract into <folder> (default current folder)."), "folder", "." },
+        { "password-file", QObject::tr("Read the password from the first line of <file>, - for stdin."), "file", "-" },
+        { rekeyOption, QObject::tr("Rewrap the keys of all encrypted files, archives and chunk lists under <folder>, and of the chunk store, for a new password and exit."), "folder" },
+        { "new-password-file", QObject::tr("Read the new password from the first line of <file>, - for stdin."), "file", "-" },
+        { testOption, QObject::tr("Check the password against <path>, or every encrypted file under it, without decrypting, and exit."), "path" }
+    });
+    parser.process(arguments);
+
+    if (parser.isSet(testOption))
+        return execTest(parser);
+
+    if (parser.isSet(rekeyOption))
+        return execRekey(parser);
+
+    if (parser.isSet(listOption) || parser.isSet(extractOption))
+        return execArchive(parser);
+
+    return execGenerate(parser);
+}
+
+int CommandLine::execArchive(const QCommandLineParser &parser)
+{
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    QString errorString;
+    if (!usePassword(parser.value("password-file"), errorString)) {
+        err << errorString << endl;
+        return 1;
+    }
+
+    const auto fileName = parser.isSet(listOption) ? parser.value(listOption) : parser.value(extractOption);
+    ArchiveReader reader(fileName);
+    if (!reader.open({ Settings::instance().key() }, errorString)) {
+        err << QString("'%1': %2").arg(fileName).arg(errorString) << endl;
+        return 1;
+    }
+
+    if (parser.isSet(listOption)) {
+        for (const auto &i : reader.entries())
+            out << i.size << '\t' << QDateTime::fromMSecsSinceEpoch(i.modified).toString(Qt::ISODate) << '\t' << i.name << '\n';
+        return 0;
+    }
+
+    QVector<int> indexes;
+    if (parser.isSet("entry")) {
+        for (const auto &i : parser.values("entry")) {
+            const auto index = reader.indexOf(i);
+            if (index < 0) {
+                err << QObject::tr("'%1': No such entry in the archive").arg(i) << endl;
+                return 1;
+            }
+            indexes << index;
+        }
+    } else {
+        indexes.resize(reader.entries().size());
+        std::iota(indexes.begin(), indexes.end(), 0);
+    }
+
+    QMutex lastErrorMutex;
+    QString lastError;
+    std::atomic_bool interruptionRequested(false);
+    QtConcurrent::blockingMap(indexes, [&] (const int index) {
+        if (interruptionRequested)
+            return;
+
+        QString entryErrorString;
+        if (!reader.extract(reader.entries().at(index), parser.value("output"), interruptionRequested, ArchiveWriter::ProgressCallback(), entryErrorString)) {
+            QMutexLocker locker(&lastErrorMutex);
+            if (lastError.isEmpty())
+                lastError = entryErrorString;
+            interruptionRequested = true;
+        }
+    });
+
+    if (!lastError.isEmpty()) {
+        err << lastError << endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+int CommandLine::execRekey(const QCommandLineParser &parser)
+{
+    QTextStream err(stderr);
+
+    QString errorString;
+    Rekey::Keys oldKeys, newKeys;
+    if (!usePassword(parser.value("password-file"), errorString)) {
+        err << errorString << endl;
+        return 1;
+    }
+    oldKeys = Rekey::Keys { Settings::instance().key(), Settings::instance().signature() };
+
+    if (!usePassword(parser.value("new-password-file"), errorString)) {
+        err << errorString << endl;
+        return 1;
+    }
+    newKeys = Rekey::Keys { Settings::instance().key(), Settings::instance().signature() };
+
+    QStringList fileNames;
+    const QStringList nameFilters { "*" + TaskJob::encryptedFileExt, "*" + TaskJob::archiveFileExt, "*" + TaskJob::chunkListFileExt };
+    QDirIterator iterator(parser.value(rekeyOption), nameFilters, QDir::Files | QDir::Hidden | QDir::NoSymLinks, QDirIterator::Subdirectories);
+    while (iterator.hasNext())
+        fileNames << iterator.next();
+
+    // The chunks themselves are encrypted with the store key, only its key file has to be rewrapped
+    const auto storeKeyFileName = ChunkStore::keyFileName(Settings::instance().chunkStoreFolder());
+    if (QFile::exists(storeKeyFileName))
+        fileNames << storeKeyFileName;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QMutex errorsMutex;
+    QStringList errors;
+    QtConcurrent::blockingMap(fileNames, [&] (const QString &fileName) {
+        QString fileErrorString;
+        if (!Rekey::rekeyFile(fileName, oldKeys, newKeys, fileErrorString)) {
+            QMutexLocker locker(&errorsMutex);
+            errors << QString("'%1': %2").arg(fileName).arg(fileErrorString);
+        }
+    });
+
+    for (const auto &i : errors)
+        err << i << endl;
+
+    err << QObject::tr("Rekeyed %1 of %2 files in %3 ms").arg(fileNames.size() - errors.size()).arg(fileNames.size()).arg(timer.elapsed()) << endl;
+
+    return (errors.isEmpty() ? 0 : 1);
+}
+
+int CommandLine::execTest(const QCommandLineParser &parser)
+{
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    QString errorString;
+    if (!usePassword(parser.value("password-file"), errorString)) {
+        err << errorString << endl;
+        return 1;
+    }
+
+    const Settings::Keys keys { Settings::instance().key(), Settings::instance().signature() };
+
+    QStringList fileNames;
+    const QFileInfo pathInfo(parser.value(testOption));
+    if (pathInfo.isDir()) {
+        QDirIterator iterator(pathInfo.filePath(), { "*" + TaskJob::encryptedFileExt }, QDir::Files | QDir::Hidden | QDir::NoSymLinks, QDirIterator::Subdirectories);
+        while (iterator.hasNext())
+            fileNames << iterator.next();
+    } else {
+        fileNames << pathInfo.filePath();
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QMutex mismatchesMutex;
+    QStringList mismatches;
+    QtConcurrent::blockingMap(fileNames, [&] (const QString &fileName) {
+        QFile file(fileName);
+        if (!file.open(QFile::ReadOnly) || !TaskJob::matchesPassword(file, keys)) {
+            QMutexLocker locker(&mismatchesMutex);
+            mismatches << fileName;
+        }
+    });
+
+    for (const auto &i : mismatches)
+        out << i << '\n';
+    out.flush();
+
+    err << QObject::tr("%1 of %2 files match the password, checked in %3 ms").arg(fileNames.size() - mismatches.size()).arg(fileNames.size()).arg(timer.elapsed()) << endl;
+
+    return (mismatches.isEmpty() ? 0 : 1);
+}
+
+int CommandLine::execGenerate(const QCommandLineParser &parser)
+{
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    bool ok = false;
+    const auto count = parser.value(generateOption).toInt(&ok);
+    if (!ok || (count < 0)) {
+        err << QObject::tr("Invalid password count: %1").arg(parser.value(generateOption)) << endl;
+        return 1;
+    }
+
+    const auto length = parser.value("length").toInt(&ok);
+    if (!ok || (length <= 5)) {
+        err << QObject::tr("The password length should be greater than 5") << endl;
+        return 1;
+    }
+
+    const auto wordCount = parser.value("words").toInt(&ok);
+    if (!ok || (wordCount <= 0)) {
+        err << QObject::tr("Invalid word count: %1").arg(parser.value("words")) << endl;
+        return 1;
+    }
+
+    PasswordGenerator::Options options;
+    if (parser.isSet("digits"))
+        options |= PasswordGenerator::DigitsOption;
+    if (parser.isSet("minus"))
+        options |= PasswordGenerator::MinusOption;
+    if (parser.isSet("underline"))
+        options |= PasswordGenerator::UnderlineOption;
+    if (parser.isSet("space"))
+        options |= PasswordGenerator::SpaceOption;
+    if (parser.isSet("special"))
+        options |= PasswordGenerator::SpecialOption;
+    if (parser.isSet("brackets"))
+        options |= PasswordGenerator::BracketsOption;
+
+    QStringList words;
+    if (parser.isSet("passphrase")) {
+        QString errorString;
+        if (!readWords(parser.value("passphrase"), words, errorString)) {
+            err << errorString << endl;
+            return 1;
+        }
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    try {
+        for (auto done = 0; done < count; ) {
+            const auto size = std::min(sliceSize, count - done);
+            const auto slice = words.isEmpty()
+                ? PasswordGenerator::generate(options, length, size)
+                : PasswordGenerator::generatePassphrases(words, wordCount, parser.value("separator"), size);
+            for (const auto &i : slice)
+                out << i << '\n';
+            done += size;
+        }
+        out.flush();
+    } catch (const Crypto::Exception &exception) {
+        err << exception.errorMessage() << endl;
+        return 1;
+    }
+
+    const auto elapsed = std::max<qint64>(timer.elapsed(), 1);
+    err << QObject::tr("Generated %1 in %2 ms (%3 per second)").arg(count).arg(elapsed).arg(qint64(count) * 1000 / elapsed) << endl;
+
+    return 0;
+}
@@ -0,0 +1,28 @@
+#ifndef COMMANDLINE_H
+#define COMMANDLINE_H
+
+#include <QStringList>
+
+class QCommandLineParser;
+
+// CommandLine
+class CommandLine
+{
+    Q_DISABLE_COPY(CommandLine)
+
+private:
+    CommandLine() {}
+    virtual ~CommandLine() {}
+
+public:
+    static bool isBatchMode(int argc, char *argv[]);
+    static int exec(const QStringList &arguments);
+
+private:
+    static int execArchive(const QCommandLineParser &parser);
+    static int execRekey(const QCommandLineParser &parser);
+    static int execTest(const QCommandLineParser &parser);
+    static int execGenerate(const QCommandLineParser &parser);
+};
+
+#endif // COMMANDLINE_H
@@ -1,6 +1,26 @@
 #include "Crypto.h"
 
+#include <QHash>
+#include <QMutex>
+
 #include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#if defined(Q_PROCESSOR_X86)
+#  if defined(Q_CC_MSVC)
+#    include <intrin.h>
+#  else
+#    include <cpuid.h>
+#  endif
+#elif defined(Q_PROCESSOR_ARM_64) && defined(Q_OS_LINUX)
+#  include <asm/hwcap.h>
+#  include <sys/auxv.h>
+#endif
 
 using namespace Crypto;
 
@@ -20,10 +40,65 @@ void Base::throwLastError()
 
 // Cipher
 
-Cipher::Cipher(const EVP_CIPHER_CTX &context)
+Cipher::Cipher(EVP_CIPHER_CTX *context, const Algorithm algorithm, const EVP_CIPHER *cipher, const QByteArray &key, const bool encrypt, const int tagSize)
     : Base()
     , _context(context)
-{}
+    , _algorithm(algorithm)
+    , _cipher(cipher)
+    , _key(key)
+    , _encrypt(encrypt)
+    , _tagSize(tagSize)
+{
+    Q_CHECK_PTR(_context);
+    Q_CHECK_PTR(_cipher);
+}
+
+void Cipher::reinitialize(const QByteArray &key, const QByteArray &iv, const bool encrypt)
+{
+    // A new IV keeps the key schedule and a new key replaces it in place, only switching direction needs a full initialization
+    auto initialized = false;
+    if (encrypt == _encrypt) {
+        const auto keyData = (key != _key) ? (const uchar*)key.constData() : Q_NULLPTR;
+        initialized = EVP_CipherInit_ex(_context, Q_NULLPTR, Q_NULLPTR, keyData, (const uchar*)iv.constData(), encrypt);
+    } else {
+        EVP_CIPHER_CTX_reset(_context);
+        initialized = EVP_CipherInit_ex(_context, _cipher, Q_NULLPTR, (const uchar*)key.constData(), (const uchar*)iv.constData(), encrypt);
+        _encrypt = encrypt;
+    }
+
+    if (!initialized)
+        throwLastError();
+
+    _key = key;
+}
+
+void Cipher::setAad(const QByteArray &aad)
+{
+    Q_ASSERT(_tagSize > 0);
+
+    auto length = 0;
+    if (!aad.isEmpty() && !EVP_CipherUpdate(_context, Q_NULLPTR, &length, (const uchar*)aad.constData(), aad.length()))
+        throwLastError();
+}
+
+QByteArray Cipher::tag()
+{
+    Q_ASSERT(_tagSize > 0);
+
+    QByteArray buffer(_tagSize, 0);
+    if (!EVP_CIPHER_CTX_ctrl(_context, EVP_CTRL_GCM_GET_TAG, _tagSize, buffer.data()))
+        throwLastError();
+
+    return buffer;
+}
+
+void Cipher::setTag(const QByteArray &tag)
+{
+    Q_ASSERT((_tagSize > 0) && (tag.length() == _tagSize));
+
+    if (!EVP_CIPHER_CTX_ctrl(_context, EVP_CTRL_GCM_SET_TAG, tag.length(), const_cast<char*>(tag.constData())))
+        throwLastError();
+}
 
 QByteArray Cipher::update(const QByteArray &data)
 {
@@ -32,33 +107,92 @@ QByteArray Cipher::update(const QByteArray &data)
         return QByteArray();
 
     QByteArray buffer(length + EVP_MAX_BLOCK_LENGTH, 0);
-    if (!EVP_CipherUpdate(&_context, (uchar*)buffer.data(), &length, (const uchar*)data.constData(), length))
+    buffer.truncate(update(data.constData(), length, buffer.data()));
+
+    return buffer;
+}
+
+int Cipher::update(const char *data, const int length, char *output)
+{
+    if (0 == length)
+        return 0;
+
+    auto outputLength = 0;
+    if (!EVP_CipherUpdate(_context, (uchar*)output, &outputLength, (const uchar*)data, length))
         throwLastError();
 
-    return buffer.left(length);
+    return outputLength;
 }
 
 QByteArray Cipher::updateFinal()
 {
     auto length = 0;
     QByteArray buffer(EVP_MAX_BLOCK_LENGTH, 0);
-    if (!EVP_CipherFinal(&_context, (uchar*)buffer.data(), &length))
+    if (!EVP_CipherFinal_ex(_context, (uchar*)buffer.data(), &length)) {
+        if (_tagSize > 0)
+            throw Exception(Exception::Error::AuthenticationError, "The data is corrupted or has been tampered with");
+
         throwLastError();
+    }
 
     return buffer.left(length);
 }
 
+// CipherLease
+
+CipherLease::CipherLease()
+    : _cipher(Q_NULLPTR)
+{}
+
+CipherLease::CipherLease(Cipher *cipher)
+    : _cipher(cipher)
+{}
+
+CipherLease::CipherLease(CipherLease &&other)
+    : _cipher(other._cipher)
+{
+    other._cipher = Q_NULLPTR;
+}
+
+CipherLease::~CipherLease()
+{
+    release();
+}
+
+CipherLease& CipherLease::operator=(CipherLease &&other)
+{
+    if (&other != this) {
+        release();
+        _cipher = other._cipher;
+        other._cipher = Q_NULLPTR;
+    }
+
+    return (*this);
+}
+
+void CipherLease::release()
+{
+    if (Q_NULLPTR != _cipher) {
+        Factory::releaseCipher(_cipher);
+        _cipher = Q_NULLPTR;
+    }
+}
+
 // Digest
 
-Digest::Digest(const EVP_MD_CTX &context)
+Digest::Digest(EVP_MD_CTX *context)
     : Base()
     , _context(context)
 {}
 
 void Digest::update(const QByteArray &data)
 {
-    auto length = data.length();
-    if ((length > 0) && !EVP_DigestUpdate(&_context, data.constData(), length))
+    update(data.constData(), data.length());
+}
+
+void Digest::update(const char *data, const int length)
+{
+    if ((length > 0) && !EVP_DigestUpdate(_context, data, length))
         throwLastError();
 }
 
@@ -66,7 +200,7 @@ QByteArray Digest::updateFinal()
 {
     auto length = 0u;
     QByteArray buffer(EVP_MAX_MD_SIZE, 0);
-    if (!EVP_DigestFinal(&_context, (uchar*)buffer.data(), &length))
+    if (!EVP_DigestFinal_ex(_context, (uchar*)buffer.data(), &length))
         throwLastError();
 
     return buffer.left(length);
@@ -74,24 +208,40 @@ QByteArray Digest::updateFinal()
 
 // Signer
 
-Signer::Signer(const EVP_MD_CTX &context, const KeyPtr &key)
+Signer::Signer(EVP_MD_CTX *context, const KeyPtr &key)
     : Base()
-    , _context(context)
+    , _context(EVP_MD_CTX_new())
+    , _initialContext(context)
     , _key(key)
-{}
+{
+    Q_CHECK_PTR(_initialContext);
+}
+
+Signer::~Signer()
+{
+    EVP_MD_CTX_free(_context);
+    EVP_MD_CTX_free(_initialContext);
+}
+
+void Signer::reset()
+{
+    // Copying the keyed context is much cheaper than running EVP_DigestSignInit again
+    if ((Q_NULLPTR == _context) || !EVP_MD_CTX_copy_ex(_context, _initialContext))
+        throwLastError();
+}
 
 void Signer::update(const QByteArray &data)
 {
     auto length = data.length();
-    if ((length > 0) && !EVP_DigestSignUpdate(&_context, data.constData(), length))
+    if ((length > 0) && !EVP_DigestSignUpdate(_context, data.constData(), length))
         throwLastError();
 }
 
 QByteArray Signer::updateFinal()
 {
-    size_t length = 0;
     QByteArray buffer(EVP_MAX_MD_SIZE, 0);
-    if (!EVP_DigestSignFinal(&_context, (uchar*)buffer.data(), &length))
+    size_t length = buffer.length();
+    if (!EVP_DigestSignFinal(_context, (uchar*)buffer.data(), &length))
         throwLastError();
 
     return buffer.left(length);
@@ -99,17 +249,94 @@ QByteArray Signer::updateFinal()
 
 // Factory
 
+struct LocalContexts {
+    std::vector<Cipher*> ciphers[4];
+    QByteArray signerKey;
+    std::unique_ptr<Signer> signer;
+
+    ~LocalContexts()
+    {
+        for (auto &i : ciphers) {
+            for (auto j : i)
+                delete j;
+        }
+    }
+};
+
+static thread_local LocalContexts localContexts;
+
+static const AlgorithmInfo algorithms[] = {
+    { Algorithm::Aes256Cbc,        "AES-256-CBC",       16, 0 },
+    { Algorithm::Aes256Ctr,        "AES-256-CTR",       16, 0 },
+    { Algorithm::Aes256Gcm,        "AES-256-GCM",       12, 16 },
+    { Algorithm::ChaCha20Poly1305, "ChaCha20-Poly1305", 12, 16 }
+};
+
+static CpuFeatures detectCpuFeatures()
+{
+    CpuFeatures features = { false, false };
+
+#if defined(Q_PROCESSOR_X86)
+    uint leaf1[4] = { 0, 0, 0, 0 };
+#  if defined(Q_CC_MSVC)
+    int info[4];
+    __cpuid(info, 1);
+    std::copy(info, info + 4, leaf1);
+#  else
+    __get_cpuid(1, &leaf1[0], &leaf1[1], &leaf1[2], &leaf1[3]);
+#  endif
+    features.aes               = leaf1[2] & (1u << 25);
+    features.carrylessMultiply = leaf1[2] & (1u << 1);
+#elif defined(Q_PROCESSOR_ARM_64) && defined(Q_OS_LINUX)
+    const auto hwcap = getauxval(AT_HWCAP);
+    features.aes               = hwcap & HWCAP_AES;
+    features.carrylessMultiply = hwcap & HWCAP_PMULL;
+#elif defined(Q_PROCESSOR_ARM_64) && defined(Q_OS_DARWIN)
+    features.aes               = true;
+    features.carrylessMultiply = true;
+#endif
+
+    return features;
+}
+
+// The OWASP recommendation for PBKDF2-HMAC-SHA512
+const quint32 Factory::stretchIterations = 210000;
+
 Factory::Factory()
     : Base()
 {
-    ERR_load_crypto_strings();
-    OpenSSL_add_all_algorithms();
+    OPENSSL_init_crypto(OPENSSL_INIT_LOAD_CRYPTO_STRINGS | OPENSSL_INIT_ADD_ALL_CIPHERS | OPENSSL_INIT_ADD_ALL_DIGESTS, Q_NULLPTR);
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    for (const auto &i : algorithms)
+        _ciphers[static_cast<int>(i.algorithm)] = EVP_CIPHER_fetch(Q_NULLPTR, i.name, Q_NULLPTR);
+
+    _digests[static_cast<int>(SHA::SHA256)] = EVP_MD_fetch(Q_NULLPTR, "SHA256", Q_NULLPTR);
+    _digests[static_cast<int>(SHA::SHA512)] = EVP_MD_fetch(Q_NULLPTR, "SHA512", Q_NULLPTR);
+#else
+    _ciphers[static_cast<int>(Algorithm::Aes256Cbc)] = EVP_aes_256_cbc();
+    _ciphers[static_cast<int>(Algorithm::Aes256Ctr)] = EVP_aes_256_ctr();
+    _ciphers[static_cast<int>(Algorithm::Aes256Gcm)] = EVP_aes_256_gcm();
+#  if !defined(OPENSSL_NO_CHACHA) && !defined(OPENSSL_NO_POLY1305)
+    _ciphers[static_cast<int>(Algorithm::ChaCha20Poly1305)] = EVP_chacha20_poly1305();
+#  else
+    _ciphers[static_cast<int>(Algorithm::ChaCha20Poly1305)] = Q_NULLPTR;
+#  endif
+
+    _digests[static_cast<int>(SHA::SHA256)] = EVP_sha256();
+    _digests[static_cast<int>(SHA::SHA512)] = EVP_sha512();
+#endif
 }
 
 Factory::~Factory()
 {
-    EVP_cleanup();
-    ERR_free_strings();
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    for (auto i : _ciphers)
+        EVP_CIPHER_free(const_cast<EVP_CIPHER*>(i));
+
+    for (auto i : _digests)
+        EVP_MD_free(const_cast<EVP_MD*>(i));
+#endif
 }
 
 Factory& Factory::instance()
@@ -166,31 +393,118 @@ QByteArray Factory::decrypt(const QByteArray &data, const QString &password)
     return (buffer + cipher->updateFinal());
 }
 
-CipherPtr Factory::createCipher(const QString &password, const bool encrypt)
+QByteArray Factory::randomBytes(const int size)
+{
+    QByteArray buffer(size, 0);
+    if ((size > 0) && (1 != RAND_bytes((uchar*)buffer.data(), size)))
+        instance().throwLastError();
+
+    return buffer;
+}
+
+QByteArray Factory::deriveKey(const QString &password)
 {
     if (password.isEmpty())
         throw Exception(Exception::Error::EmptyPasswordError, "The password shouldn't be empty");
 
     const auto passwordHash = hash(password.toUtf8());
-    Q_ASSERT(!passwordHash.isEmpty());
+    Q_ASSERT(passwordHash.length() >= 32);
 
-    EVP_CIPHER_CTX context;
-    if (!EVP_CipherInit(&context, EVP_aes_256_cbc(), (const uchar*)passwordHash.constData(), Q_NULLPTR, encrypt))
-        throwLastError();
+    return passwordHash.left(32);
+}
+
+QByteArray Factory::stretchKey(const QByteArray &key, const QByteArray &salt, const quint32 iterations)
+{
+    static QMutex mutex;
+    static QHash<QByteArray, QByteArray> cache;
+    static const int cacheSize = 64;
+
+    QByteArray cacheKey;
+    cacheKey += hash(key + salt, Factory::SHA::SHA256);
+    cacheKey += QByteArray::number(iterations);
+
+    QMutexLocker locker(&mutex);
+    const auto cached = cache.constFind(cacheKey);
+    if (cache.constEnd() != cached)
+        return cached.value();
+
+    // Deriving takes a while on purpose, other salts shouldn't wait for it
+    locker.unlock();
+
+    QByteArray stretchedKey(32, 0);
+    if (1 != PKCS5_PBKDF2_HMAC(key.constData(), key.size(), (const uchar*)salt.constData(), salt.size(), static_cast<int>(iterations), EVP_sha512(), stretchedKey.size(), (uchar*)stretchedKey.data()))
+        instance().throwLastError();
+
+    locker.relock();
+    if (cache.size() >= cacheSize)
+        cache.clear();
+    cache.insert(cacheKey, stretchedKey);
+
+    return stretchedKey;
+}
+
+const QByteArray& Factory::sessionSalt()
+{
+    static const QByteArray salt = randomBytes(16);
+
+    return salt;
+}
+
+const CpuFeatures& Factory::cpuFeatures()
+{
+    static const CpuFeatures features = detectCpuFeatures();
+
+    return features;
+}
+
+const AlgorithmInfo* Factory::algorithmInfo(const Algorithm algorithm)
+{
+    for (const auto &i : algorithms) {
+        if ((i.algorithm == algorithm) && (Q_NULLPTR != instance()._ciphers[static_cast<int>(algorithm)]))
+            return (&i);
+    }
+
+    return Q_NULLPTR;
+}
+
+Algorithm Factory::preferredAlgorithm()
+{
+    // GCM is only fast with hardware AES and carry-less multiplication, everywhere else
+    // ChaCha20-Poly1305 wins by a large margin; OpenSSL picks the widest code path for either itself
+    const auto &features = cpuFeatures();
+    if ((features.aes && features.carrylessMultiply) || !algorithmInfo(Algorithm::ChaCha20Poly1305))
+        return Algorithm::Aes256Gcm;
+
+    return Algorithm::ChaCha20Poly1305;
+}
+
+CipherPtr Factory::createCipher(const QString &password, const bool encrypt)
+{
+    return createCipher(password, Algorithm::Aes256Cbc, QByteArray(algorithmInfo(Algorithm::Aes256Cbc)->ivSize, 0), encrypt);
+}
+
+CipherPtr Factory::createCipher(const QString &password, const Algorithm algorithm, const QByteArray &iv, const bool encrypt)
+{
+    return CipherPtr(newCipher(deriveKey(password), algorithm, iv, encrypt));
+}
+
+CipherPtr Factory::createStreamCipher(const QString &password, const QByteArray &iv, const qint64 offset)
+{
+    Q_ASSERT(streamIvSize == iv.size());
 
-    return CipherPtr(new Cipher(context));
+    return CipherPtr(newCipher(deriveKey(password), Algorithm::Aes256Ctr, streamCounter(iv, offset), true));
 }
 
 DigestPtr Factory::createDigest(const Factory::SHA sha)
 {
-    static const EVP_MD* md[] = {
-        EVP_sha256(),
-        EVP_sha512()
-    };
+    auto context = EVP_MD_CTX_new();
+    if (Q_NULLPTR == context)
+        throwLastError();
 
-    EVP_MD_CTX context;
-    if (!EVP_DigestInit(&context, md[static_cast<int>(sha)]))
+    if (!EVP_DigestInit_ex(context, _digests[static_cast<int>(sha)], Q_NULLPTR)) {
+        EVP_MD_CTX_free(context);
         throwLastError();
+    }
 
     return DigestPtr(new Digest(context));
 }
@@ -203,18 +517,117 @@ SignerPtr Factory::createSigner(const QString &password)
     const auto passwordHash = hash(password.toUtf8());
     Q_ASSERT(!passwordHash.isEmpty());
 
-    KeyPtr key(EVP_PKEY_new_mac_key(EVP_PKEY_HMAC, Q_NULLPTR, (const uchar*)passwordHash.constData(), passwordHash.length()), EVP_PKEY_free);
-    if (!key)
+    return SignerPtr(newSigner(passwordHash));
+}
+
+CipherLease Factory::acquireCipher(const QByteArray &key, const Algorithm algorithm, const QByteArray &iv, const bool encrypt)
+{
+    // Contexts are shared by all keys: with a data key per file, a context per key would never be reused
+    auto &ciphers = localContexts.ciphers[static_cast<int>(algorithm)];
+    if (ciphers.empty())
+        return CipherLease(newCipher(key, algorithm, iv, encrypt));
+
+    auto cipher = ciphers.back();
+    ciphers.pop_back();
+
+    try {
+        cipher->reinitialize(key, iv, encrypt);
+    } catch (...) {
+        delete cipher;
+        throw;
+    }
+
+    return CipherLease(cipher);
+}
+
+CipherLease Factory::acquireStreamCipher(const QByteArray &key, const QByteArray &iv, const qint64 offset)
+{
+    Q_ASSERT(streamIvSize == iv.size());
+
+    return acquireCipher(key, Algorithm::Aes256Ctr, streamCounter(iv, offset), true);
+}
+
+Signer& Factory::localSigner(const QByteArray &key)
+{
+    auto &contexts = localContexts;
+    if (!contexts.signer || (contexts.signerKey != key)) {
+        contexts.signer.reset(newSigner(key));
+        contexts.signerKey = key;
+    } else {
+        contexts.signer->reset();
+    }
+
+    return (*contexts.signer);
+}
+
+QByteArray Factory::streamCounter(const QByteArray &iv, const qint64 offset)
+{
+    Q_ASSERT((offset >= 0) && (0 == offset % streamIvSize));
+
+    // CTR lets us start in the middle of a stream: the counter is the IV plus the number of blocks skipped
+    auto counter = iv;
+    auto carry = static_cast<quint64>(offset / streamIvSize);
+    for (auto i = counter.size() - 1; (i >= 0) && (carry > 0); --i) {
+        carry += static_cast<uchar>(counter.at(i));
+        counter[i] = static_cast<char>(carry & 0xff);
+        carry >>= 8;
+    }
+
+    return counter;
+}
+
+void Factory::releaseCipher(Cipher *cipher)
+{
+    Q_CHECK_PTR(cipher);
+
+    // A thread only holds a few contexts at once, anything beyond that was a burst that isn't worth keeping
+    static const std::size_t maxPooledCiphers = 8;
+
+    auto &ciphers = localContexts.ciphers[static_cast<int>(cipher->_algorithm)];
+    if (ciphers.size() < maxPooledCiphers)
+        ciphers.push_back(cipher);
+    else
+        delete cipher;
+}
+
+Cipher* Factory::newCipher(const QByteArray &key, const Algorithm algorithm, const QByteArray &iv, const bool encrypt)
+{
+    const auto info = algorithmInfo(algorithm);
+    if (Q_NULLPTR == info)
+        throw Exception(Exception::Error::OpenSslError, "The cipher isn't supported by this build of OpenSSL");
+
+    Q_ASSERT(iv.length() == info->ivSize);
+
+    const auto cipher = _ciphers[static_cast<int>(algorithm)];
+    auto context = EVP_CIPHER_CTX_new();
+    if (Q_NULLPTR == context)
+        throwLastError();
+
+    if (!EVP_CipherInit_ex(context, cipher, Q_NULLPTR, (const uchar*)key.constData(), (const uchar*)iv.constData(), encrypt)) {
+        EVP_CIPHER_CTX_free(context);
+        throwLastError();
+    }
+
+    return new Cipher(context, algorithm, cipher, key, encrypt, info->tagSize);
+}
+
+Signer* Factory::newSigner(const QByteArray &key)
+{
+    KeyPtr pkey(EVP_PKEY_new_raw_private_key(EVP_PKEY_HMAC, Q_NULLPTR, (const uchar*)key.constData(), key.length()), EVP_PKEY_free);
+    if (!pkey)
         throwLastError();
 
-    EVP_MD_CTX context;
-    if (!EVP_DigestInit(&context, EVP_sha512()))
+    auto context = EVP_MD_CTX_new();
+    if (Q_NULLPTR == context)
         throwLastError();
 
-    if (!EVP_DigestSignInit(&context, Q_NULLPTR, EVP_sha512(), Q_NULLPTR, key.data())) {
-        EVP_MD_CTX_cleanup(&context);
+    if (!EVP_DigestSignInit(context, Q_NULLPTR, _digests[static_cast<int>(SHA::SHA512)], Q_NULLPTR, pkey.data())) {
+        EVP_MD_CTX_free(context);
         throwLastError();
     }
 
-    return SignerPtr(new Signer(context, key));
+    std::unique_ptr<Signer> signer(new Signer(context, pkey));
+    signer->reset();
+
+    return signer.release();
 }
@@ -12,12 +12,35 @@ namespace Crypto
     // KeyPtr
     using KeyPtr = QSharedPointer<EVP_PKEY>;
 
+    // Algorithm
+    enum class Algorithm : quint8 {
+        Aes256Cbc        = 0,
+        Aes256Ctr        = 1,
+        Aes256Gcm        = 2,
+        ChaCha20Poly1305 = 3
+    };
+
+    // AlgorithmInfo
+    struct AlgorithmInfo {
+        Algorithm algorithm;
+        const char *name;
+        int ivSize;
+        int tagSize;
+    };
+
+    // CpuFeatures
+    struct CpuFeatures {
+        bool aes;
+        bool carrylessMultiply;
+    };
+
     // Exception
     class Exception
     {
     public:
         enum class Error {
             EmptyPasswordError,
+            AuthenticationError,
             OpenSslError
         };
 
@@ -47,21 +70,63 @@ namespace Crypto
         friend class Factory;
 
     private:
-        Cipher(const EVP_CIPHER_CTX &context);
+        Cipher(EVP_CIPHER_CTX *context, const Algorithm algorithm, const EVP_CIPHER *cipher, const QByteArray &key, const bool encrypt, const int tagSize);
 
     public:
-        virtual ~Cipher() { EVP_CIPHER_CTX_cleanup(&_context); }
+        virtual ~Cipher() { EVP_CIPHER_CTX_free(_context); }
+
+        bool isAuthenticated() const { return (_tagSize > 0); }
+
+        void reinitialize(const QByteArray &key, const QByteArray &iv, const bool encrypt);
+
+        void setAad(const QByteArray &aad);
+        QByteArray tag();
+        void setTag(const QByteArray &tag);
 
         QByteArray update(const QByteArray &data);
+        // The output needs room for length + EVP_MAX_BLOCK_LENGTH bytes, the number written is returned
+        int update(const char *data, const int length, char *output);
         QByteArray updateFinal();
 
     private:
-        EVP_CIPHER_CTX _context;
+        EVP_CIPHER_CTX *_context;
+        const Algorithm _algorithm;
+        const EVP_CIPHER *_cipher;
+        QByteArray _key;
+        bool _encrypt;
+        int _tagSize;
     };
 
     // CipherPtr
     using CipherPtr = QSharedPointer<Cipher>;
 
+    // CipherLease
+    class CipherLease
+    {
+        Q_DISABLE_COPY(CipherLease)
+
+        friend class Factory;
+
+    private:
+        explicit CipherLease(Cipher *cipher);
+
+    public:
+        CipherLease();
+        CipherLease(CipherLease &&other);
+        ~CipherLease();
+
+        CipherLease& operator=(CipherLease &&other);
+
+        explicit operator bool() const { return (Q_NULLPTR != _cipher); }
+        Cipher* operator->() const { return _cipher; }
+        Cipher& operator*() const { return (*_cipher); }
+
+    private:
+        void release();
+
+        Cipher *_cipher;
+    };
+
     // Digest
     class Digest : public Base
     {
@@ -70,16 +135,17 @@ namespace Crypto
         friend class Factory;
 
     private:
-        Digest(const EVP_MD_CTX &context);
+        Digest(EVP_MD_CTX *context);
 
     public:
-        virtual ~Digest() { EVP_MD_CTX_cleanup(&_context); }
+        virtual ~Digest() { EVP_MD_CTX_free(_context); }
 
         void update(const QByteArray &data);
+        void update(const char *data, const int length);
         QByteArray updateFinal();
 
     private:
-        EVP_MD_CTX _context;
+        EVP_MD_CTX *_context;
     };
 
     // DigestPtr
@@ -93,16 +159,18 @@ namespace Crypto
         friend class Factory;
 
     private:
-        Signer(const EVP_MD_CTX &context, const KeyPtr &key);
+        Signer(EVP_MD_CTX *context, const KeyPtr &key);
 
     public:
-        virtual ~Signer() { EVP_MD_CTX_cleanup(&_context); }
+        virtual ~Signer();
 
+        void reset();
         void update(const QByteArray &data);
         QByteArray updateFinal();
 
     private:
-        EVP_MD_CTX _context;
+        EVP_MD_CTX *_context;
+        EVP_MD_CTX *_initialContext;
         KeyPtr _key;
     };
 
@@ -114,7 +182,11 @@ namespace Crypto
     {
         Q_DISABLE_COPY(Factory)
 
+        friend class CipherLease;
+
     public:
+        static const int streamIvSize = 16;
+
         enum class SHA {
             SHA256,
             SHA512
@@ -131,10 +203,39 @@ namespace Crypto
         static QByteArray sign(const QByteArray &data, const QString &password);
         static QByteArray encrypt(const QByteArray &data, const QString &password);
         static QByteArray decrypt(const QByteArray &data, const QString &password);
+        static QByteArray randomBytes(const int size);
+        static QByteArray deriveKey(const QString &password);
+        // PBKDF2-HMAC-SHA512 over a key from deriveKey(), the results are cached since many files share a salt
+        static QByteArray stretchKey(const QByteArray &key, const QByteArray &salt, const quint32 iterations);
+        // A random salt for stretching keys, the same for every file this process writes
+        static const QByteArray& sessionSalt();
+        static const quint32 stretchIterations;
+
+        static const CpuFeatures& cpuFeatures();
+        static const AlgorithmInfo* algorithmInfo(const Algorithm algorithm);
+        static Algorithm preferredAlgorithm();
 
         CipherPtr createCipher(const QString &password, const bool encrypt = true);
+        CipherPtr createCipher(const QString &password, const Algorithm algorithm, const QByteArray &iv, const bool encrypt);
+        CipherPtr createStreamCipher(const QString &password, const QByteArray &iv, const qint64 offset = 0);
         DigestPtr createDigest(const Factory::SHA sha = Factory::SHA::SHA512);
         SignerPtr createSigner(const QString &password);
+
+        // Contexts are kept per thread and reinitialized on reuse, so workers neither lock nor allocate
+        CipherLease acquireCipher(const QByteArray &key, const Algorithm algorithm, const QByteArray &iv, const bool encrypt);
+        CipherLease acquireStreamCipher(const QByteArray &key, const QByteArray &iv, const qint64 offset = 0);
+        Signer& localSigner(const QByteArray &key);
+
+    private:
+        static QByteArray streamCounter(const QByteArray &iv, const qint64 offset);
+        static void releaseCipher(Cipher *cipher);
+
+        Cipher* newCipher(const QByteArray &key, const Algorithm algorithm, const QByteArray &iv, const bool encrypt);
+        Signer* newSigner(const QByteArray &key);
+
+        // Algorithm handles are looked up once, which spares OpenSSL 3 a provider fetch for every context
+        const EVP_CIPHER *_ciphers[4];
+        const EVP_MD *_digests[2];
     };
 }
 
@@ -0,0 +1,166 @@
+#include "FileHeader.h"
+
+#include <QIODevice>
+#include <QtEndian>
+
+#include <openssl/crypto.h>
+
+using namespace Crypto;
+
+// Data keys are always wrapped with AES-256-GCM, which keeps the key slot the same size on every machine
+static const Algorithm wrapAlgorithm = Algorithm::Aes256Gcm;
+
+static const QByteArray keyCheckLabel = "Haralug key check";
+static const int saltSize = 16;
+static const int keyCheckSize = 16;
+
+static QByteArray keyCheckValue(const QByteArray &keyEncryptionKey, const QByteArray &salt)
+{
+    auto &signer = Factory::instance().localSigner(keyEncryptionKey);
+    signer.update(keyCheckLabel + salt);
+
+    return signer.updateFinal().left(keyCheckSize);
+}
+
+static bool readField(QIODevice &device, QByteArray &field)
+{
+    const auto size = device.read(1);
+    if (size.size() != 1)
+        return false;
+
+    field = device.read(static_cast<quint8>(size.at(0)));
+
+    return (field.size() == static_cast<quint8>(size.at(0)));
+}
+
+static void appendField(QByteArray &data, const QByteArray &field)
+{
+    Q_ASSERT(field.size() <= 0xff);
+
+    data.append(static_cast<char>(field.size()));
+    data.append(field);
+}
+
+// FileHeader
+
+const QByteArray FileHeader::magic = "HRLG";
+const quint8 FileHeader::version = 5;
+
+FileHeader::FileHeader()
+    : formatVersion(version)
+    , algorithm(Algorithm::Aes256Gcm)
+    , kdfIterations(0)
+{}
+
+bool FileHeader::hasMagic(QIODevice &device)
+{
+    return (device.peek(magic.size()) == magic);
+}
+
+bool FileHeader::read(QIODevice &device)
+{
+    // magic | version | algorithm | IV size | IV | salt size | salt | key check size | key check
+    // | KDF size | KDF iterations | KDF salt | wrapped key size | wrapped key
+    if (device.read(magic.size()) != magic)
+        return false;
+
+    const auto fixed = device.read(2);
+    if (fixed.size() != 2)
+        return false;
+
+    formatVersion = static_cast<quint8>(fixed.at(0));
+    if (version != formatVersion)
+        return false;
+
+    algorithm = static_cast<Algorithm>(fixed.at(1));
+
+    QByteArray kdf;
+    if (!readField(device, iv) || !readField(device, salt) || !readField(device, keyCheck) || !readField(device, kdf) || (kdf.size() <= 4))
+        return false;
+
+    kdfIterations = qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(kdf.constData()));
+    kdfSalt = kdf.mid(4);
+    // A damaged or crafted header mustn't stall the worker in the KDF
+    if ((0 == kdfIterations) || (kdfIterations > 100 * Factory::stretchIterations))
+        return false;
+
+    return readField(device, wrappedKey);
+}
+
+QByteArray FileHeader::toByteArray() const
+{
+    QByteArray kdf(4, 0);
+    qToBigEndian(kdfIterations, reinterpret_cast<uchar*>(kdf.data()));
+
+    auto data = aad();
+    appendField(data, salt);
+    appendField(data, keyCheck);
+    appendField(data, kdf + kdfSalt);
+    appendField(data, wrappedKey);
+
+    return data;
+}
+
+QByteArray FileHeader::aad() const
+{
+    QByteArray data(magic);
+    data.append(static_cast<char>(formatVersion));
+    data.append(static_cast<char>(algorithm));
+    appendField(data, iv);
+
+    return data;
+}
+
+void FileHeader::setKeyCheck(const QByteArray &keyEncryptionKey)
+{
+    kdfSalt       = Factory::sessionSalt();
+    kdfIterations = Factory::stretchIterations;
+    salt          = Factory::randomBytes(saltSize);
+    keyCheck      = keyCheckValue(stretchedKey(keyEncryptionKey), salt);
+}
+
+bool FileHeader::checkKey(const QByteArray &keyEncryptionKey) const
+{
+    if (keyCheck.size() != keyCheckSize)
+        return false;
+
+    const auto expected = keyCheckValue(stretchedKey(keyEncryptionKey), salt);
+
+    return (0 == CRYPTO_memcmp(expected.constData(), keyCheck.constData(), keyCheckSize));
+}
+
+void FileHeader::wrapKey(const QByteArray &keyEncryptionKey, const QByteArray &dataKey)
+{
+    Q_ASSERT(!kdfSalt.isEmpty());
+
+    // wrap IV | wrapped data key | tag, bound to this file through the AAD
+    const auto wrapIv = Factory::randomBytes(Factory::algorithmInfo(wrapAlgorithm)->ivSize);
+    auto cipher = Factory::instance().acquireCipher(stretchedKey(keyEncryptionKey), wrapAlgorithm, wrapIv, true);
+    cipher->setAad(aad());
+
+    wrappedKey = wrapIv;
+    wrappedKey += cipher->update(dataKey);
+    wrappedKey += cipher->updateFinal();
+    wrappedKey += cipher->tag();
+}
+
+QByteArray FileHeader::unwrapKey(const QByteArray &keyEncryptionKey) const
+{
+    const auto info = Factory::algorithmInfo(wrapAlgorithm);
+    if (wrappedKey.size() <= info->ivSize + info->tagSize)
+        throw Exception(Exception::Error::AuthenticationError, "The file key is damaged");
+
+    auto cipher = Factory::instance().acquireCipher(stretchedKey(keyEncryptionKey), wrapAlgorithm, wrappedKey.left(info->ivSize), false);
+    cipher->setTag(wrappedKey.right(info->tagSize));
+    cipher->setAad(aad());
+
+    auto dataKey = cipher->update(wrappedKey.mid(info->ivSize, wrappedKey.size() - info->ivSize - info->tagSize));
+    dataKey += cipher->updateFinal();
+
+    return dataKey;
+}
+
+QByteArray FileHeader::stretchedKey(const QByteArray &key) const
+{
+    return Factory::stretchKey(key, kdfSalt, kdfIterations);
+}
@@ -0,0 +1,47 @@
+#ifndef FILEHEADER_H
+#define FILEHEADER_H
+
+#include <QByteArray>
+
+#include "Crypto.h"
+
+class QIODevice;
+
+// FileHeader
+struct FileHeader
+{
+    static const QByteArray magic;
+    static const quint8 version;
+
+    FileHeader();
+
+    static bool hasMagic(QIODevice &device);
+
+    bool read(QIODevice &device);
+    QByteArray toByteArray() const;
+
+    // The payload is authenticated with everything but the key check and key slot, so rekeying leaves it valid
+    QByteArray aad() const;
+
+    // The key is stretched with PBKDF2 over the KDF salt before it is checked or wraps the data key;
+    // the files of one session share that salt, so the key is only stretched once
+    void setKeyCheck(const QByteArray &keyEncryptionKey);
+    bool checkKey(const QByteArray &keyEncryptionKey) const;
+
+    void wrapKey(const QByteArray &keyEncryptionKey, const QByteArray &dataKey);
+    QByteArray unwrapKey(const QByteArray &keyEncryptionKey) const;
+
+    quint8 formatVersion;
+    Crypto::Algorithm algorithm;
+    QByteArray iv;
+    QByteArray salt;
+    QByteArray keyCheck;
+    QByteArray kdfSalt;
+    quint32 kdfIterations;
+    QByteArray wrappedKey;
+
+private:
+    QByteArray stretchedKey(const QByteArray &key) const;
+};
+
+#endif // FILEHEADER_H
@@ -0,0 +1,120 @@
+#include "FileNameAllocator.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+// FileNameAllocator
+
+FileNameAllocator& FileNameAllocator::instance()
+{
+    static FileNameAllocator instance;
+
+    return instance;
+}
+
+QString FileNameAllocator::reserve(const QString &filePath, bool encrypted, QString &errorString)
+{
+    const QFileInfo info(filePath);
+
+    const auto absolutePath = info.absolutePath();
+    const auto fileName     = info.fileName();
+
+    QString baseName, suffix;
+    splitFileName(fileName, encrypted, baseName, suffix);
+    if (!suffix.isEmpty())
+        suffix.prepend('.');
+
+    const auto indexKey = QString("%1/%2/%3").arg(absolutePath).arg(baseName).arg(suffix);
+
+    forever {
+        QString candidate;
+
+        {
+            QMutexLocker locker(&_mutex);
+
+            auto &entries = folderEntries(absolutePath);
+            if (!entries.contains(fileName)) {
+                candidate = fileName;
+            } else {
+                auto &index = _nextIndexes[indexKey];
+                do {
+                    candidate = QString("%1-%2%3").arg(baseName).arg(++index).arg(suffix);
+                } while (entries.contains(candidate));
+            }
+            entries.insert(candidate);
+        }
+
+        // The cache is only a hint for this process, O_EXCL settles races with everybody else
+        const auto candidatePath = QString("%1/%2").arg(absolutePath).arg(candidate);
+        QFile file(candidatePath);
+        if (file.open(QFile::WriteOnly | QFile::NewOnly))
+            return candidatePath;
+
+        if (!file.exists()) {
+            errorString = file.errorString();
+            release(candidatePath);
+
+            return QString();
+        }
+    }
+}
+
+void FileNameAllocator::release(const QString &filePath)
+{
+    const QFileInfo info(filePath);
+
+    QMutexLocker locker(&_mutex);
+    auto i = _entries.find(info.absolutePath());
+    if (i != _entries.end())
+        i->remove(info.fileName());
+}
+
+void FileNameAllocator::clear()
+{
+    QMutexLocker locker(&_mutex);
+    _entries.clear();
+    _nextIndexes.clear();
+}
+
+void FileNameAllocator::splitFileName(const QString &fileName, bool encrypted, QString &baseName, QString &suffix)
+{
+    const auto lastDot = fileName.lastIndexOf('.');
+
+    if (encrypted) {
+        // "name.ext.haralug" keeps "ext.haralug" together, ".name.haralug" keeps its leading dot
+        const auto previousDot = (lastDot > 0) ? fileName.lastIndexOf('.', lastDot - 1) : -1;
+        if ((previousDot > 0) && (previousDot < lastDot - 1) && (lastDot < fileName.length() - 1)) {
+            baseName = fileName.left(previousDot);
+            suffix   = fileName.mid(previousDot + 1);
+        } else if ((0 == previousDot) && (lastDot > 1) && (lastDot < fileName.length() - 1)) {
+            baseName = fileName.left(lastDot);
+            suffix   = fileName.mid(lastDot + 1);
+        } else {
+            const auto firstDot = fileName.indexOf('.');
+            baseName = (firstDot < 0) ? fileName : fileName.left(firstDot);
+            suffix   = (lastDot < 0) ? QString() : fileName.mid(lastDot + 1);
+        }
+    } else {
+        if ((lastDot > 0) && (lastDot < fileName.length() - 1)) {
+            baseName = fileName.left(lastDot);
+            suffix   = fileName.mid(lastDot + 1);
+        } else {
+            baseName = fileName;
+            suffix.clear();
+        }
+    }
+}
+
+QSet<QString>& FileNameAllocator::folderEntries(const QString &folder)
+{
+    auto i = _entries.find(folder);
+    if (i == _entries.end()) {
+        QSet<QString> entries;
+        for (const auto &name : QDir(folder).entryList(QDir::AllEntries | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot))
+            entries.insert(name);
+        i = _entries.insert(folder, entries);
+    }
+
+    return (*i);
+}
@@ -0,0 +1,35 @@
+#ifndef FILENAMEALLOCATOR_H
+#define FILENAMEALLOCATOR_H
+
+#include <QHash>
+#include <QMutex>
+#include <QSet>
+#include <QString>
+
+// FileNameAllocator
+class FileNameAllocator
+{
+    Q_DISABLE_COPY(FileNameAllocator)
+
+private:
+    FileNameAllocator() {}
+    virtual ~FileNameAllocator() {}
+
+public:
+    static FileNameAllocator& instance();
+
+    QString reserve(const QString &filePath, bool encrypted, QString &errorString);
+    void release(const QString &filePath);
+    void clear();
+
+private:
+    static void splitFileName(const QString &fileName, bool encrypted, QString &baseName, QString &suffix);
+
+    QSet<QString>& folderEntries(const QString &folder);
+
+    QMutex _mutex;
+    QHash<QString, QSet<QString>> _entries;
+    QHash<QString, quint64> _nextIndexes;
+};
+
+#endif // FILENAMEALLOCATOR_H
@@ -0,0 +1,260 @@
+#include "FolderWatcher.h"
+
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QSocketNotifier>
+#include <QTimer>
+
+#include "ThreadPool.h"
+
+#ifdef Q_OS_LINUX
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    // Files are reported after this much quiet, or after the longer delay during a continuous burst
+    const int quietTime   = 500;
+    const int maximumWait = 2000;
+}
+
+// FolderWatcher
+
+FolderWatcher::FolderWatcher(QObject *parent)
+    : QObject(parent)
+#ifdef Q_OS_LINUX
+    , _inotify(::inotify_init1(IN_NONBLOCK | IN_CLOEXEC))
+    , _notifier(Q_NULLPTR)
+#endif
+    , _watcher(Q_NULLPTR)
+    , _quietTimer(new QTimer(this))
+{
+    _quietTimer->setSingleShot(true);
+    _quietTimer->setInterval(quietTime);
+    connect(_quietTimer, &QTimer::timeout, this, &FolderWatcher::flush);
+
+#ifdef Q_OS_LINUX
+    if (_inotify >= 0) {
+        _notifier = new QSocketNotifier(_inotify, QSocketNotifier::Read, this);
+        connect(_notifier, &QSocketNotifier::activated, this, &FolderWatcher::readEvents);
+
+        return;
+    }
+#endif
+
+    _watcher = new QFileSystemWatcher(this);
+    connect(_watcher, &QFileSystemWatcher::directoryChanged, this, &FolderWatcher::scanFolder);
+}
+
+FolderWatcher::~FolderWatcher()
+{
+#ifdef Q_OS_LINUX
+    if (_inotify >= 0)
+        ::close(_inotify);
+#endif
+}
+
+void FolderWatcher::setFolders(const QStringList &folders)
+{
+    unwatchAll();
+
+    _folders = folders;
+    for (const auto &i : _folders) {
+        watchFolder(i);
+        QDirIterator iterator(i, QDir::Dirs | QDir::NoDotAndDotDot | QDir::NoSymLinks, QDirIterator::Subdirectories);
+        while (iterator.hasNext())
+            watchFolder(iterator.next());
+    }
+}
+
+bool FolderWatcher::isIgnored(const QString &fileName)
+{
+    // Hidden and temporary files as well as everything Haralug writes itself
+    const auto name = QFileInfo(fileName).fileName();
+
+    return name.startsWith('.')
+        || name.endsWith(TaskJob::encryptedFileExt)
+        || name.endsWith(TaskJob::journalFileExt)
+        || name.endsWith(TaskJob::archiveFileExt)
+        || name.endsWith(TaskJob::chunkListFileExt);
+}
+
+void FolderWatcher::watchFolder(const QString &folder)
+{
+    // The files that are already there are not new
+    auto &files = _folderFiles[folder];
+    for (const auto &i : QDir(folder).entryList(QDir::Files | QDir::NoSymLinks))
+        files.insert(i);
+
+    addWatch(folder);
+}
+
+void FolderWatcher::addWatch(const QString &folder)
+{
+#ifdef Q_OS_LINUX
+    if (_inotify >= 0) {
+        const auto watch = ::inotify_add_watch(_inotify, QFile::encodeName(folder).constData(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR);
+        if (watch >= 0)
+            _watches.insert(watch, folder);
+
+        return;
+    }
+#endif
+
+    _watcher->addPath(folder);
+}
+
+void FolderWatcher::unwatchAll()
+{
+#ifdef Q_OS_LINUX
+    for (auto i = _watches.cbegin(); i != _watches.cend(); ++i)
+        ::inotify_rm_watch(_inotify, i.key());
+    _watches.clear();
+#endif
+
+    if (Q_NULLPTR != _watcher) {
+        const auto directories = _watcher->directories();
+        if (!directories.isEmpty())
+            _watcher->removePaths(directories);
+    }
+    _folderFiles.clear();
+    _growingFiles.clear();
+}
+
+void FolderWatcher::addFile(const QString &fileName)
+{
+    if (isIgnored(fileName) || _pendingSet.contains(fileName))
+        return;
+
+    if (_pendingFiles.isEmpty())
+        _pendingTimer.start();
+
+    _pendingSet.insert(fileName);
+    _pendingFiles << fileName;
+
+    if (_pendingTimer.elapsed() < maximumWait)
+        _quietTimer->start();
+}
+
+void FolderWatcher::flush()
+{
+    if (!_growingFiles.isEmpty()) {
+        // Still being written: checked again after the next quiet period
+        for (auto i = _growingFiles.begin(); i != _growingFiles.end(); ) {
+            const QFileInfo fileInfo(i.key());
+            if (!fileInfo.exists()) {
+                i = _growingFiles.erase(i);
+            } else if (fileInfo.size() == i.value()) {
+                addFile(i.key());
+                i = _growingFiles.erase(i);
+            } else {
+                i.value() = fileInfo.size();
+                ++i;
+            }
+        }
+
+        if (!_growingFiles.isEmpty())
+            _quietTimer->start();
+    }
+
+    if (_pendingFiles.isEmpty())
+        return;
+
+    const auto fileNames = _pendingFiles;
+    _pendingFiles.clear();
+    _pendingSet.clear();
+
+    Q_EMIT filesReady(fileNames);
+}
+
+#ifdef Q_OS_LINUX
+void FolderWatcher::readEvents()
+{
+    alignas(struct inotify_event) char buffer[64 * 1024];
+
+    for (;;) {
+        const auto length = ::read(_inotify, buffer, sizeof(buffer));
+        if (length <= 0)
+            break;
+
+        for (auto position = buffer; position < buffer + length; ) {
+            const auto event = reinterpret_cast<const struct inotify_event*>(position);
+            position += sizeof(struct inotify_event) + event->len;
+
+            // Events were dropped, the folders are listed again to find the files they were about
+            if (0 != (event->mask & IN_Q_OVERFLOW)) {
+                rescan();
+                continue;
+            }
+
+            if (0 != (event->mask & IN_IGNORED)) {
+                _watches.remove(event->wd);
+                continue;
+            }
+
+            const auto folder = _watches.value(event->wd);
+            if (folder.isEmpty() || (0 == event->len))
+                continue;
+
+            const auto name = QFile::decodeName(event->name);
+            const auto path = QDir(folder).filePath(name);
+            if (0 != (event->mask & IN_ISDIR)) {
+                // Whatever a new folder already holds is new as well, including the files of a folder moved in
+                if (!_folderFiles.contains(path)) {
+                    _folderFiles.insert(path, QSet<QString>());
+                    addWatch(path);
+                    scanFolder(path);
+                }
+            } else if (0 != (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))) {
+                _folderFiles[folder].insert(name);
+                _growingFiles.remove(path);
+                addFile(path);
+            }
+        }
+    }
+}
+#endif
+
+void FolderWatcher::rescan()
+{
+    const auto folders = _folderFiles.keys();
+    for (const auto &i : folders)
+        scanFolder(i);
+}
+
+void FolderWatcher::scanFolder(const QString &folder)
+{
+    if (!QFileInfo(folder).isDir()) {
+        _folderFiles.remove(folder);
+
+        return;
+    }
+
+    QStringList newFolders;
+    auto &files = _folderFiles[folder];
+    for (const auto &fileInfo : QDir(folder).entryInfoList(QDir::AllEntries | QDir::NoDotAndDotDot | QDir::NoSymLinks)) {
+        const auto path = fileInfo.absoluteFilePath();
+        if (fileInfo.isDir()) {
+            if (!_folderFiles.contains(path))
+                newFolders << path;
+        } else if (!files.contains(fileInfo.fileName())) {
+            files.insert(fileInfo.fileName());
+            if (!isIgnored(path))
+                _growingFiles.insert(path, fileInfo.size());
+        }
+    }
+
+    // Everything inside a new folder is new as well
+    for (const auto &i : newFolders) {
+        _folderFiles.insert(i, QSet<QString>());
+        addWatch(i);
+        scanFolder(i);
+    }
+
+    if (!_growingFiles.isEmpty())
+        _quietTimer->start();
+}
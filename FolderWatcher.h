@@ -0,0 +1,63 @@
+#ifndef FOLDERWATCHER_H
+#define FOLDERWATCHER_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QObject>
+#include <QSet>
+#include <QStringList>
+
+class QFileSystemWatcher;
+class QSocketNotifier;
+class QTimer;
+
+// FolderWatcher
+class FolderWatcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit FolderWatcher(QObject *parent = Q_NULLPTR);
+    virtual ~FolderWatcher();
+
+    const QStringList& folders() const { return _folders; }
+    // Subfolders are watched as well; only files written from now on are reported
+    void setFolders(const QStringList &folders);
+
+    // Files that have been written and closed, collected until the folders have been quiet for a moment
+    Q_SIGNAL void filesReady(const QStringList &fileNames);
+
+private:
+    static bool isIgnored(const QString &fileName);
+
+    void watchFolder(const QString &folder);
+    void addWatch(const QString &folder);
+    void unwatchAll();
+    void addFile(const QString &fileName);
+    void flush();
+
+#ifdef Q_OS_LINUX
+    void readEvents();
+
+    int _inotify;
+    QSocketNotifier *_notifier;
+    QHash<int, QString> _watches;
+#endif
+
+    // Without inotify, or after its queue overflowed, a folder is listed again and compared with what it held before;
+    // a new file is reported once its size stops changing
+    void scanFolder(const QString &folder);
+    void rescan();
+
+    QFileSystemWatcher *_watcher;
+    QHash<QString, QSet<QString>> _folderFiles;
+    QHash<QString, qint64> _growingFiles;
+
+    QStringList _folders;
+    QStringList _pendingFiles;
+    QSet<QString> _pendingSet;
+    QTimer *_quietTimer;
+    QElapsedTimer _pendingTimer;
+};
+
+#endif // FOLDERWATCHER_H
@@ -1,7 +1,7 @@
 #include "GeneratePasswordDialog.h"
 
 #include "PasswordGenerator.h"
-#include "Utils.h"
+#include "PasswordStrength.h"
 
 // GeneratePasswordDialog
 
@@ -14,7 +14,9 @@ GeneratePasswordDialog::GeneratePasswordDialog(QWidget *parent)
 void GeneratePasswordDialog::on_lineEditPassword_textChanged(const QString &text)
 {
     buttonOk->setEnabled(!text.isEmpty());
-    progressBar->setValue(Utils::passwordStrength(text));
+    const auto strength = PasswordStrength::evaluate(text);
+    progressBar->setValue(strength.level);
+    progressBar->setToolTip(tr("%1 bits").arg(qRound(strength.entropy)));
 }
 
 void GeneratePasswordDialog::on_buttonGenerate_clicked()
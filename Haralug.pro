@@ -1,6 +1,7 @@
 QT += \
     core \
     gui \
+    concurrent \
     widgets
 
 TARGET = Haralug
@@ -12,38 +13,69 @@ DEFINES += \
 
 SOURCES += \
     main.cpp \
+    Archive.cpp \
+    BufferPool.cpp \
+    Chunker.cpp \
+    ChunkStore.cpp \
+    CommandLine.cpp \
     Crypto.cpp \
+    FileHeader.cpp \
+    FileNameAllocator.cpp \
+    FolderWatcher.cpp \
+    InPlaceJournal.cpp \
+    IoBackend.cpp \
     MainWindow.cpp \
+    Manifest.cpp \
     TaskManager.cpp \
     Settings.cpp \
     ThreadPool.cpp \
+    Throttle.cpp \
     Utils.cpp \
     PasswordDialog.cpp \
+    PasswordStrength.cpp \
+    Rekey.cpp \
     PasswordGenerator.cpp \
     GeneratePasswordDialog.cpp \
     TaskTableModel.cpp \
     AboutDialog.cpp \
+    LimitsDialog.cpp \
     TaskProgressItemDelegate.cpp
 
 HEADERS += \
+    Archive.h \
+    BufferPool.h \
+    Chunker.h \
+    ChunkStore.h \
+    CommandLine.h \
     Crypto.h \
+    FileHeader.h \
+    FileNameAllocator.h \
+    FolderWatcher.h \
+    InPlaceJournal.h \
+    IoBackend.h \
     MainWindow.h \
+    Manifest.h \
     TaskManager.h \
     Settings.h \
     ThreadPool.h \
+    Throttle.h \
     Utils.h \
     PasswordDialog.h \
+    PasswordStrength.h \
+    Rekey.h \
     PasswordGenerator.h \
     GeneratePasswordDialog.h \
     TaskTableModel.h \
     AboutDialog.h \
+    LimitsDialog.h \
     TaskProgressItemDelegate.h
 
 FORMS += \
     MainWindow.ui \
     PasswordDialog.ui \
     GeneratePasswordDialog.ui \
-    AboutDialog.ui
+    AboutDialog.ui \
+    LimitsDialog.ui
 
 RESOURCES += \
     resources.qrc
@@ -51,6 +83,14 @@ RESOURCES += \
 LIBS += \
     -lcrypto
 
+linux {
+    packagesExist(liburing) {
+        CONFIG += link_pkgconfig
+        PKGCONFIG += liburing
+        DEFINES += HARALUG_IO_URING
+    }
+}
+
 win32 {
     RC_FILE = Haralug.rc
 }
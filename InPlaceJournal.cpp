@@ -0,0 +1,112 @@
+#include "InPlaceJournal.h"
+
+#include <QDataStream>
+#include <QFile>
+#include <QSaveFile>
+
+#include "Crypto.h"
+
+#include <algorithm>
+
+static const quint32 journalMagic   = 0x484a524e; // "HJRN"
+static const quint32 journalVersion = 3;
+
+// A slot is the SHA-256 of the rest, the chunk offset, the chunk size and the chunk
+static const int slotHashSize   = 32;
+static const int slotHeaderSize = slotHashSize + 8 + 4;
+
+// InPlaceJournal
+
+const qint64 InPlaceJournal::chunkSize = 1024 * 1024;
+
+InPlaceJournal::InPlaceJournal()
+    : encrypt(true)
+    , payloadSize(0)
+    , offset(0)
+{}
+
+bool InPlaceJournal::load(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QFile::ReadOnly))
+        return false;
+
+    QDataStream stream(&file);
+
+    quint32 magic = 0, version = 0;
+    stream >> magic >> version;
+    if ((journalMagic != magic) || (journalVersion != version))
+        return false;
+
+    stream >> encrypt >> trailer >> iv >> payloadSize >> offset;
+
+    return ((QDataStream::Ok == stream.status()) && (offset >= 0) && (offset <= payloadSize));
+}
+
+bool InPlaceJournal::save(const QString &fileName, QString &errorString) const
+{
+    // QSaveFile syncs the new journal and atomically replaces the old one, so a crash leaves either of them intact
+    QSaveFile file(fileName);
+    if (!file.open(QFile::WriteOnly)) {
+        errorString = file.errorString();
+
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream << journalMagic << journalVersion << encrypt << trailer << iv << payloadSize << offset;
+
+    if ((QDataStream::Ok != stream.status()) || !file.commit()) {
+        errorString = file.errorString();
+
+        return false;
+    }
+
+    return true;
+}
+
+bool InPlaceJournal::writeSlot(QFile &file, const qint64 slotsOffset, const qint64 chunkOffset, const QByteArray &encryptedChunk) const
+{
+    Q_ASSERT(encryptedChunk.size() <= chunkSize);
+
+    QByteArray slot;
+    QDataStream stream(&slot, QIODevice::WriteOnly);
+    stream << chunkOffset << static_cast<qint32>(encryptedChunk.size());
+    slot += encryptedChunk;
+    // The IV ties the slot to this job, leftovers of another one never match
+    slot.prepend(Crypto::Factory::hash(iv + slot, Crypto::Factory::SHA::SHA256));
+
+    const auto index = (chunkOffset / chunkSize) % 2;
+
+    return (file.seek(slotsOffset + index * (slotHeaderSize + chunkSize)) && (file.write(slot) == slot.size()));
+}
+
+QVector<InPlaceJournal::Slot> InPlaceJournal::readSlots(QFile &file, const qint64 slotsOffset) const
+{
+    QVector<Slot> logged;
+    for (auto index = 0; index < 2; ++index) {
+        if (!file.seek(slotsOffset + index * (slotHeaderSize + chunkSize)))
+            continue;
+
+        const auto header = file.read(slotHeaderSize);
+        if (header.size() != slotHeaderSize)
+            continue;
+
+        QDataStream stream(header.mid(slotHashSize));
+        qint64 slotOffset = 0;
+        qint32 slotSize = 0;
+        stream >> slotOffset >> slotSize;
+        if ((slotSize <= 0) || (slotSize > chunkSize) || (slotOffset < offset) || (slotOffset + slotSize > payloadSize))
+            continue;
+
+        const auto chunk = file.read(slotSize);
+        if ((chunk.size() != slotSize) || (Crypto::Factory::hash(iv + header.mid(slotHashSize) + chunk, Crypto::Factory::SHA::SHA256) != header.left(slotHashSize)))
+            continue;
+
+        logged.append({ slotOffset, chunk });
+    }
+
+    std::sort(logged.begin(), logged.end(), [] (const Slot &left, const Slot &right) { return (left.chunkOffset < right.chunkOffset); });
+
+    return logged;
+}
@@ -0,0 +1,40 @@
+#ifndef INPLACEJOURNAL_H
+#define INPLACEJOURNAL_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+class QFile;
+
+// InPlaceJournal
+struct InPlaceJournal
+{
+    struct Slot {
+        qint64 chunkOffset;
+        QByteArray encryptedChunk;
+    };
+
+    InPlaceJournal();
+
+    static const qint64 chunkSize;
+
+    // The journal file only describes the job, it is written when the job starts and when it is done
+    bool load(const QString &fileName);
+    bool save(const QString &fileName, QString &errorString) const;
+
+    // Every chunk is logged to one of two slots behind the payload before it is overwritten, always in its
+    // encrypted form; syncing the file makes the slot and the previously overwritten chunk durable at once
+    bool writeSlot(QFile &file, const qint64 slotsOffset, const qint64 chunkOffset, const QByteArray &encryptedChunk) const;
+    // The slots that were completely written, in the order of their chunks
+    QVector<InPlaceJournal::Slot> readSlots(QFile &file, const qint64 slotsOffset) const;
+
+    bool encrypt;
+    // The trailer the encrypted file ends with, it carries the wrapped key of the stream
+    QByteArray trailer;
+    QByteArray iv;
+    qint64 payloadSize;
+    qint64 offset;
+};
+
+#endif // INPLACEJOURNAL_H
@@ -0,0 +1,457 @@
+#include "IoBackend.h"
+
+#include <QFile>
+#include <QVector>
+
+#ifdef HARALUG_IO_URING
+#include <liburing.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <utility>
+
+#include "BufferPool.h"
+#endif
+
+// FileIoBackend
+class FileIoBackend : public IoBackend
+{
+public:
+    FileIoBackend(QFile &inputFile, const qint64 inputEnd, QFile &outputFile)
+        : IoBackend(inputFile.pos(), inputEnd, outputFile.pos())
+        , _inputFile(inputFile)
+        , _outputFile(outputFile)
+    {}
+
+    using IoBackend::write;
+
+    bool read(char *buffer, const char *&data, int &length) Q_DECL_OVERRIDE
+    {
+        const auto size = _inputFile.read(buffer, qMin(chunkSize, _inputEnd - _inputPos));
+        if ((size < 0) || ((0 == size) && (_inputPos < _inputEnd))) {
+            _errorString = QString("'%1': %2").arg(_inputFile.fileName()).arg(_inputFile.errorString());
+
+            return false;
+        }
+
+        data = buffer;
+        length = static_cast<int>(size);
+        _inputPos += size;
+
+        return true;
+    }
+
+    bool write(const char *data, const int length) Q_DECL_OVERRIDE
+    {
+        if (_outputFile.write(data, length) != length) {
+            _errorString = QString("'%1': %2").arg(_outputFile.fileName()).arg(_outputFile.errorString());
+
+            return false;
+        }
+
+        _outputPos += length;
+
+        return true;
+    }
+
+    bool flush() Q_DECL_OVERRIDE
+    {
+        if (!_outputFile.flush()) {
+            _errorString = QString("'%1': %2").arg(_outputFile.fileName()).arg(_outputFile.errorString());
+
+            return false;
+        }
+
+        return true;
+    }
+
+private:
+    QFile &_inputFile;
+    QFile &_outputFile;
+};
+
+#ifdef HARALUG_IO_URING
+
+// UringContext
+// A ring and its registered buffers are set up once per worker thread and reused by all of its jobs;
+// the buffers are borrowed from the BufferPool, so they count against the same memory limit
+class UringContext
+{
+    Q_DISABLE_COPY(UringContext)
+
+public:
+    static const int queueDepth = 8;
+    static const qint64 writeSlotSize;
+
+    UringContext()
+        : _initialized(false)
+        , _broken(false)
+        , _inFlight(0)
+    {}
+
+    ~UringContext()
+    {
+        if (!_initialized)
+            return;
+
+        // Only a ring that can't be waited on keeps its buffers, the kernel may still write into them
+        if (!drain()) {
+            for (auto &i : _leases)
+                new BufferLease(std::move(i));
+        }
+
+        io_uring_unregister_buffers(&_ring);
+        io_uring_queue_exit(&_ring);
+    }
+
+    // Q_NULLPTR when no ring can be set up now
+    static UringContext* local()
+    {
+        static std::atomic_bool warned(false);
+        static thread_local std::unique_ptr<UringContext> context;
+        static thread_local bool failed = false;
+
+        // A broken ring is replaced, its buffers go back to the pool once its requests are complete
+        if (context && context->_broken)
+            context.reset();
+
+        if (!context && !failed) {
+            std::unique_ptr<UringContext> newContext(new UringContext());
+            switch (newContext->initialize()) {
+            case Result::Success:
+                context = std::move(newContext);
+                break;
+            case Result::NoBuffers:
+                // Tried again by the next job, the buffers may be free by then
+                break;
+            case Result::Failure:
+                failed = true;
+                if (!warned.exchange(true))
+                    qWarning("io_uring can't be set up (is RLIMIT_MEMLOCK too low?), files are read and written with QFile");
+                break;
+            }
+        }
+
+        return context.get();
+    }
+
+    io_uring* ring() { return &_ring; }
+
+    // After a failed submission the ring may hold requests of a finished job
+    bool isBroken() const { return _broken; }
+    void setBroken() { _broken = true; }
+
+    // Every prepared request is counted until its completion has been consumed
+    void requestQueued() { ++_inFlight; }
+    void requestDone() { --_inFlight; }
+
+    // Waits for the completions of all requests the kernel has taken, the ones that were never submitted
+    // are dropped with the ring; false when the ring can't be waited on
+    bool drain()
+    {
+        const auto unsubmitted = static_cast<int>(io_uring_sq_ready(&_ring));
+        while (_inFlight > unsubmitted) {
+            io_uring_cqe *cqe = Q_NULLPTR;
+            const auto result = io_uring_wait_cqe(&_ring, &cqe);
+            if (-EINTR == result)
+                continue;
+
+            if (result < 0)
+                return false;
+
+            io_uring_cqe_seen(&_ring, cqe);
+            --_inFlight;
+        }
+
+        return true;
+    }
+
+    // A read slot uses the input half of a pool buffer, a write slot the output half
+    char* buffer(const int index) const
+    {
+        return ((index < queueDepth) ? _leases[index].input() : _leases[index - queueDepth].output());
+    }
+
+private:
+    enum class Result {
+        Success,
+        NoBuffers,
+        Failure
+    };
+
+    Result initialize()
+    {
+        Q_ASSERT(IoBackend::chunkSize + writeSlotSize <= BufferPool::bufferSize);
+
+        QVector<iovec> iovecs;
+        for (auto i = 0; i < queueDepth; ++i) {
+            _leases[i] = BufferPool::instance().tryAcquire();
+            if (!_leases[i])
+                return Result::NoBuffers;
+        }
+        for (auto i = 0; i < 2 * queueDepth; ++i)
+            iovecs << iovec { buffer(i), static_cast<size_t>((i < queueDepth) ? IoBackend::chunkSize : writeSlotSize) };
+
+        if (io_uring_queue_init(2 * queueDepth, &_ring, 0) < 0)
+            return Result::Failure;
+
+        if (io_uring_register_buffers(&_ring, iovecs.constData(), iovecs.size()) < 0) {
+            io_uring_queue_exit(&_ring);
+
+            return Result::Failure;
+        }
+
+        _initialized = true;
+
+        return Result::Success;
+    }
+
+    io_uring _ring;
+    bool _initialized;
+    bool _broken;
+    int _inFlight;
+    BufferLease _leases[queueDepth];
+};
+
+// The output half of a pool buffer has room for the cipher's extra block, so one chunk is one write
+const qint64 UringContext::writeSlotSize = IoBackend::chunkSize + 4096;
+
+// UringIoBackend
+class UringIoBackend : public IoBackend
+{
+public:
+    // Below this size setting up the reads costs more than it saves
+    static const qint64 minimumSize;
+
+    UringIoBackend(QFile &inputFile, const qint64 inputEnd, QFile &outputFile, UringContext *context)
+        : IoBackend(inputFile.pos(), inputEnd, outputFile.pos())
+        , _inputFile(inputFile)
+        , _outputFile(outputFile)
+        , _context(context)
+        , _ring(context->ring())
+        , _readOffset(inputFile.pos())
+        , _readHead(0)
+        , _readTail(0)
+        , _delivered(-1)
+    {}
+
+    ~UringIoBackend()
+    {
+        // The ring and its buffers are used by the next job, the kernel has to be done with them first
+        if (!_context->drain())
+            _context->setBroken();
+    }
+
+    bool initialize()
+    {
+        _slots.fill(Slot(), 2 * queueDepth);
+        for (auto i = queueDepth; i < 2 * queueDepth; ++i)
+            _freeWriteSlots << i;
+
+        // Keep the whole read window in flight from the start
+        while ((_readTail - _readHead < queueDepth) && submitRead()) {}
+
+        return submit(_inputFile);
+    }
+
+    using IoBackend::write;
+
+    bool read(char *buffer, const char *&data, int &length) Q_DECL_OVERRIDE
+    {
+        Q_UNUSED(buffer)
+
+        // The previously returned buffer can be refilled now
+        if (_delivered >= 0) {
+            _delivered = -1;
+            ++_readHead;
+            if (submitRead() && !submit(_inputFile))
+                return false;
+        }
+
+        length = 0;
+        if (_readHead == _readTail)
+            return true;
+
+        const auto index = static_cast<int>(_readHead % queueDepth);
+        while (!_slots.at(index).done) {
+            if (!reap())
+                return false;
+        }
+
+        auto &slot = _slots[index];
+        if (slot.result != slot.length) {
+            _errorString = QString("'%1': %2").arg(_inputFile.fileName()).arg((slot.result < 0) ? std::strerror(-slot.result) : "Unexpected end of file");
+
+            return false;
+        }
+
+        data = _context->buffer(index);
+        length = slot.length;
+        _inputPos += slot.length;
+        _delivered = index;
+
+        return true;
+    }
+
+    bool write(const char *data, const int length) Q_DECL_OVERRIDE
+    {
+        for (auto written = 0; written < length; ) {
+            while (_freeWriteSlots.isEmpty()) {
+                if (!reap())
+                    return false;
+            }
+
+            const auto index = _freeWriteSlots.takeLast();
+            const auto size = static_cast<int>(qMin<qint64>(UringContext::writeSlotSize, length - written));
+            std::memcpy(_context->buffer(index), data + written, size);
+
+            auto &slot = _slots[index];
+            slot = Slot();
+            slot.length = size;
+
+            auto sqe = io_uring_get_sqe(_ring);
+            Q_CHECK_PTR(sqe);
+            io_uring_prep_write_fixed(sqe, _outputFile.handle(), _context->buffer(index), size, _outputPos, index);
+            io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(static_cast<quintptr>(index)));
+            _context->requestQueued();
+
+            if (!submit(_outputFile))
+                return false;
+
+            _outputPos += size;
+            written += size;
+        }
+
+        return _errorString.isEmpty();
+    }
+
+    bool flush() Q_DECL_OVERRIDE
+    {
+        while (_freeWriteSlots.size() < queueDepth) {
+            if (!reap())
+                return false;
+        }
+
+        return _errorString.isEmpty();
+    }
+
+private:
+    struct Slot {
+        int length = 0;
+        int result = 0;
+        bool done = false;
+    };
+
+    static const int queueDepth = UringContext::queueDepth;
+
+    bool submit(const QFile &file)
+    {
+        const auto result = io_uring_submit(_ring);
+        if (result < 0) {
+            _context->setBroken();
+            _errorString = QString("'%1': %2").arg(file.fileName()).arg(std::strerror(-result));
+
+            return false;
+        }
+
+        return true;
+    }
+
+    bool submitRead()
+    {
+        if ((_readOffset >= _inputEnd) || (_readTail - _readHead >= queueDepth))
+            return false;
+
+        const auto index = static_cast<int>(_readTail % queueDepth);
+        auto &slot = _slots[index];
+        slot = Slot();
+        slot.length = static_cast<int>(qMin(chunkSize, _inputEnd - _readOffset));
+
+        auto sqe = io_uring_get_sqe(_ring);
+        Q_CHECK_PTR(sqe);
+        io_uring_prep_read_fixed(sqe, _inputFile.handle(), _context->buffer(index), slot.length, _readOffset, index);
+        io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(static_cast<quintptr>(index)));
+
+        _readOffset += slot.length;
+        ++_readTail;
+        _context->requestQueued();
+
+        return true;
+    }
+
+    bool reap()
+    {
+        io_uring_cqe *cqe = Q_NULLPTR;
+        const auto result = io_uring_wait_cqe(_ring, &cqe);
+        if (result < 0) {
+            if (-EINTR == result)
+                return true;
+
+            _errorString = std::strerror(-result);
+
+            return false;
+        }
+
+        const auto index = static_cast<int>(reinterpret_cast<quintptr>(io_uring_cqe_get_data(cqe)));
+        auto &slot = _slots[index];
+        slot.result = cqe->res;
+        slot.done = true;
+        io_uring_cqe_seen(_ring, cqe);
+        _context->requestDone();
+
+        if (index >= queueDepth) {
+            _freeWriteSlots << index;
+            if ((slot.result != slot.length) && _errorString.isEmpty()) {
+                _errorString = QString("'%1': %2").arg(_outputFile.fileName()).arg((slot.result < 0) ? std::strerror(-slot.result) : "Short write");
+
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    QFile &_inputFile;
+    QFile &_outputFile;
+    UringContext *_context;
+    io_uring *_ring;
+    QVector<Slot> _slots;
+    QVector<int> _freeWriteSlots;
+    qint64 _readOffset;
+    qint64 _readHead;
+    qint64 _readTail;
+    int _delivered;
+};
+
+const qint64 UringIoBackend::minimumSize = 4 * IoBackend::chunkSize;
+
+#endif // HARALUG_IO_URING
+
+// IoBackend
+
+const qint64 IoBackend::chunkSize = 256 * 1024;
+
+IoBackend::IoBackend(const qint64 inputOffset, const qint64 inputEnd, const qint64 outputOffset)
+    : _inputEnd(inputEnd)
+    , _inputPos(inputOffset)
+    , _outputPos(outputOffset)
+{}
+
+IoBackendPtr IoBackend::create(QFile &inputFile, const qint64 inputEnd, QFile &outputFile)
+{
+#ifdef HARALUG_IO_URING
+    // Buffered data would otherwise end up behind the asynchronous writes
+    if ((inputEnd - inputFile.pos() >= UringIoBackend::minimumSize) && outputFile.flush()) {
+        auto context = UringContext::local();
+        if (Q_NULLPTR != context) {
+            QSharedPointer<UringIoBackend> backend(new UringIoBackend(inputFile, inputEnd, outputFile, context));
+            if (backend->initialize())
+                return backend;
+        }
+    }
+#endif
+
+    return IoBackendPtr(new FileIoBackend(inputFile, inputEnd, outputFile));
+}
@@ -0,0 +1,47 @@
+#ifndef IOBACKEND_H
+#define IOBACKEND_H
+
+#include <QByteArray>
+#include <QSharedPointer>
+#include <QString>
+
+class QFile;
+
+// IoBackend
+class IoBackend
+{
+    Q_DISABLE_COPY(IoBackend)
+
+protected:
+    IoBackend(const qint64 inputOffset, const qint64 inputEnd, const qint64 outputOffset);
+
+public:
+    static const qint64 chunkSize;
+
+    static QSharedPointer<IoBackend> create(QFile &inputFile, const qint64 inputEnd, QFile &outputFile);
+
+    virtual ~IoBackend() {}
+
+    qint64 inputPos() const { return _inputPos; }
+    qint64 outputPos() const { return _outputPos; }
+    const QString& errorString() const { return _errorString; }
+
+    // The next chunk is read into the buffer of chunkSize bytes, or points into the backend's own memory;
+    // either way it stays valid until the next call
+    virtual bool read(char *buffer, const char *&data, int &length) = 0;
+    virtual bool write(const char *data, const int length) = 0;
+    virtual bool flush() = 0;
+
+    bool write(const QByteArray &data) { return write(data.constData(), data.size()); }
+
+protected:
+    const qint64 _inputEnd;
+    qint64 _inputPos;
+    qint64 _outputPos;
+    QString _errorString;
+};
+
+// IoBackendPtr
+using IoBackendPtr = QSharedPointer<IoBackend>;
+
+#endif // IOBACKEND_H
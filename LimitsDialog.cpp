@@ -0,0 +1,31 @@
+#include "LimitsDialog.h"
+
+#include "Settings.h"
+#include "ThreadPool.h"
+
+// LimitsDialog
+
+LimitsDialog::LimitsDialog(QWidget *parent)
+    : QDialog(parent)
+{
+    setupUi(this);
+
+    spinBoxMaxSpeed->setValue(Settings::instance().maxSpeed());
+    spinBoxMaxWorkers->setValue(Settings::instance().maxWorkers());
+    spinBoxNiceness->setValue(Settings::instance().niceness());
+    comboBoxIoPriority->setCurrentIndex(static_cast<int>(Settings::instance().ioPriority()));
+    spinBoxBufferMemory->setValue(Settings::instance().bufferMemory());
+    checkBoxPinWorkers->setChecked(Settings::instance().pinWorkers());
+}
+
+void LimitsDialog::on_buttonOk_clicked()
+{
+    Settings::instance().setMaxSpeed(spinBoxMaxSpeed->value());
+    Settings::instance().setMaxWorkers(spinBoxMaxWorkers->value());
+    Settings::instance().setNiceness(spinBoxNiceness->value());
+    Settings::instance().setIoPriority(static_cast<Utils::IoPriority>(comboBoxIoPriority->currentIndex()));
+    Settings::instance().setBufferMemory(spinBoxBufferMemory->value());
+    Settings::instance().setPinWorkers(checkBoxPinWorkers->isChecked());
+    ThreadPool::instance()->applyLimits();
+    accept();
+}
@@ -0,0 +1,18 @@
+#ifndef LIMITSDIALOG_H
+#define LIMITSDIALOG_H
+
+#include "ui_LimitsDialog.h"
+
+// LimitsDialog
+class LimitsDialog : public QDialog, private Ui::LimitsDialog
+{
+    Q_OBJECT
+
+public:
+    explicit LimitsDialog(QWidget *parent = Q_NULLPTR);
+
+private: // GUI
+    Q_SLOT void on_buttonOk_clicked();
+};
+
+#endif // LIMITSDIALOG_H
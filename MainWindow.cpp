@@ -4,14 +4,21 @@
 #include <QDesktopServices>
 #include <QDir>
 #include <QFileDialog>
+#include <QInputDialog>
 #include <QListView>
+#include <QMenu>
 #include <QMessageBox>
 #include <QMimeData>
 #include <QPointer>
+#include <QSet>
+#include <QToolButton>
 
+#include <algorithm>
 #include <functional>
 
 #include <AboutDialog.h>
+#include "FolderWatcher.h"
+#include "LimitsDialog.h"
 #include "PasswordDialog.h"
 #include "Settings.h"
 #include "TaskManager.h"
@@ -28,6 +35,7 @@ MainWindow::MainWindow()
     : QMainWindow()
     , _model(new TaskTableModel(this))
     , _filterModel(new TaskFilterProxyModel(this))
+    , _folderWatcher(new FolderWatcher(this))
 {
     setupUi(this);
     setWindowTitle(QApplication::applicationName());
@@ -39,17 +47,64 @@ MainWindow::MainWindow()
     toolBar->addSeparator();
     toolBar->addAction(actionStart);
     toolBar->addAction(actionStop);
+    toolBar->addAction(actionPause);
+    toolBar->addAction(actionResume);
     toolBar->addSeparator();
     toolBar->addAction(actionPassword);
+    toolBar->addAction(actionOptions);
     toolBar->addSeparator();
     toolBar->addAction(actionAbout);
     toolBar->addWidget(widgetSearch);
 
+    actionInPlace->setChecked(Settings::instance().inPlace());
+    actionSecureDelete->setChecked(Settings::instance().secureDelete());
+    actionBypassPageCache->setChecked(Settings::instance().bypassPageCache());
+    actionPackFolders->setChecked(Settings::instance().packFolders());
+    actionDeduplicate->setChecked(Settings::instance().deduplicate());
+    actionIncremental->setChecked(Settings::instance().incremental());
+    actionContinuous->setChecked(Settings::instance().continuous());
+
+    auto optionsMenu = new QMenu(this);
+    optionsMenu->addAction(actionInPlace);
+    optionsMenu->addAction(actionSecureDelete);
+    optionsMenu->addAction(actionBypassPageCache);
+    optionsMenu->addSeparator();
+    optionsMenu->addAction(actionPackFolders);
+    optionsMenu->addAction(actionDeduplicate);
+    optionsMenu->addAction(actionIncremental);
+    optionsMenu->addAction(actionContinuous);
+    optionsMenu->addSeparator();
+    optionsMenu->addAction(actionAddKeyringPassword);
+    optionsMenu->addAction(actionClearKeyring);
+    optionsMenu->addSeparator();
+    optionsMenu->addAction(actionWatchFolder);
+    optionsMenu->addAction(actionStopWatching);
+    optionsMenu->addSeparator();
+    optionsMenu->addAction(actionLimits);
+    actionOptions->setMenu(optionsMenu);
+    qobject_cast<QToolButton*>(toolBar->widgetForAction(actionOptions))->setPopupMode(QToolButton::InstantPopup);
+
     treeViewTasks->installEventFilter(this);
-    treeViewTasks->setItemDelegate(new TaskProgressItemDelegate(_model->columnCount() - 1, this));
+    treeViewTasks->setItemDelegate(new TaskProgressItemDelegate(TaskTableModel::StatusColumn, this));
     treeViewTasks->setModel(_filterModel);
+    // Tasks stay in the order they were added until a column is clicked
+    treeViewTasks->header()->setSortIndicator(-1, Qt::AscendingOrder);
+    treeViewTasks->setSortingEnabled(true);
+    treeViewTasks->setContextMenuPolicy(Qt::ActionsContextMenu);
+    treeViewTasks->addAction(actionPauseTasks);
+    treeViewTasks->addAction(actionResumeTasks);
+    treeViewTasks->addAction(actionRunNext);
+    treeViewTasks->addAction(actionRaisePriority);
+    treeViewTasks->addAction(actionLowerPriority);
     connect(treeViewTasks->selectionModel(), &QItemSelectionModel::selectionChanged, [this] () {
-        actionRemove->setEnabled(treeViewTasks->selectionModel()->hasSelection());
+        const auto hasSelection = treeViewTasks->selectionModel()->hasSelection();
+        const auto running = (ThreadPool::State::Running == ThreadPool::instance()->state()) || (ThreadPool::State::Paused == ThreadPool::instance()->state());
+        actionRemove->setEnabled(hasSelection);
+        actionPauseTasks->setEnabled(hasSelection && running);
+        actionResumeTasks->setEnabled(hasSelection && running);
+        actionRunNext->setEnabled(hasSelection);
+        actionRaisePriority->setEnabled(hasSelection);
+        actionLowerPriority->setEnabled(hasSelection);
     });
 
     treeViewTasks->header()->restoreState(Settings::instance().value(_keyHeaderState).toByteArray());
@@ -57,12 +112,27 @@ MainWindow::MainWindow()
         Settings::instance().setValue(_keyHeaderState, treeViewTasks->header()->saveState());
     });
 
+    actionClearKeyring->setEnabled(false);
+
+    connect(_folderWatcher, &FolderWatcher::filesReady, this, &MainWindow::addWatchedFiles);
+    _folderWatcher->setFolders(Settings::instance().watchFolders());
+    actionStopWatching->setEnabled(!_folderWatcher->folders().isEmpty());
+
     auto updateControls = [this] () {
         auto state = ThreadPool::instance()->state();
         actionStart->setVisible(ThreadPool::State::Stopped == state);
-        actionStart->setEnabled(!TaskManager::instance()->tasks().isEmpty());
-        actionStop->setVisible(ThreadPool::State::Running == state);
+        actionStart->setEnabled(!TaskManager::instance()->tasks().isEmpty() || Settings::instance().continuous());
+        actionStop->setVisible((ThreadPool::State::Running == state) || (ThreadPool::State::Paused == state));
+        actionPause->setVisible(ThreadPool::State::Running == state);
+        actionResume->setVisible(ThreadPool::State::Paused == state);
+        const auto canPauseTasks = treeViewTasks->selectionModel()->hasSelection() && ((ThreadPool::State::Running == state) || (ThreadPool::State::Paused == state));
+        actionPauseTasks->setEnabled(canPauseTasks);
+        actionResumeTasks->setEnabled(canPauseTasks);
         actionPassword->setEnabled(ThreadPool::State::Stopped == state);
+        // The limits can be changed at any time, everything else only while stopped
+        for (auto action : { actionInPlace, actionSecureDelete, actionBypassPageCache, actionPackFolders, actionDeduplicate, actionIncremental, actionContinuous, actionAddKeyringPassword })
+            action->setEnabled(ThreadPool::State::Stopped == state);
+        actionClearKeyring->setEnabled((ThreadPool::State::Stopped == state) && !Settings::instance().keyring().isEmpty());
     };
 
     connect(TaskManager::instance(), &TaskManager::taskAdded, updateControls);
@@ -74,7 +144,7 @@ MainWindow::MainWindow()
 void MainWindow::closeEvent(QCloseEvent *event)
 {
     auto threadPool = ThreadPool::instance();
-    if (ThreadPool::State::Running == threadPool->state()) {
+    if ((ThreadPool::State::Running == threadPool->state()) || (ThreadPool::State::Paused == threadPool->state())) {
         QMessageBox messageBox(this);
         messageBox.setStandardButtons(QMessageBox::Yes | QMessageBox::No);
         messageBox.setText("All running tasks will not be complete. Do you really want to exit the application?");
@@ -119,22 +189,55 @@ void MainWindow::addPath(const QString &path)
                 const auto fileName = fileInfo.fileName();
                 if (("." != fileName) && (".." != fileName))
                     scanFolder(fileInfo.absoluteFilePath());
-            } else {
+            } else if (!fileInfo.fileName().endsWith(TaskJob::journalFileExt)) {
                 TaskManager::instance()->addTask(fileInfo.absoluteFilePath());
             }
         }
     };
 
     const QFileInfo fileInfo(path);
-    if (fileInfo.isDir())
+    if (fileInfo.isDir() && Settings::instance().packFolders())
+        TaskManager::instance()->addTask(fileInfo.absoluteFilePath());
+    else if (fileInfo.isDir())
         scanFolder(fileInfo.absoluteFilePath());
-    else if (!fileInfo.isSymLink())
+    else if (!fileInfo.isSymLink() && !fileInfo.fileName().endsWith(TaskJob::journalFileExt))
         TaskManager::instance()->addTask(fileInfo.absoluteFilePath());
 }
 
+void MainWindow::addWatchedFiles(const QStringList &fileNames)
+{
+    // Files written by the tasks themselves, e.g. decrypted copies, must not come back as new tasks,
+    // and a file reported again after a rescan already has one
+    QSet<QString> taskFiles;
+    for (const auto task : TaskManager::instance()->tasks()) {
+        taskFiles.insert(task->inputFile());
+        taskFiles.insert(task->outputFile());
+    }
+
+    for (const auto &i : fileNames) {
+        const QFileInfo fileInfo(i);
+        if (fileInfo.isFile() && !fileInfo.isSymLink() && !taskFiles.contains(fileInfo.absoluteFilePath())) {
+            taskFiles.insert(fileInfo.absoluteFilePath());
+            TaskManager::instance()->addTask(fileInfo.absoluteFilePath());
+        }
+    }
+}
+
+QList<int> MainWindow::selectedTaskRows() const
+{
+    auto indexes = treeViewTasks->selectionModel()->selectedRows();
+    std::sort(indexes.begin(), indexes.end());
+
+    QList<int> rows;
+    for (const auto &i : indexes)
+        rows << _filterModel->mapToSource(i).row();
+
+    return rows;
+}
+
 void MainWindow::on_filterEdit_textChanged(const QString &text)
 {
-    _filterModel->setFilterRegExp(QRegExp(text, Qt::CaseInsensitive, QRegExp::FixedString));
+    _filterModel->setFilterText(text);
 }
 
 void MainWindow::on_actionAdd_triggered()
@@ -155,6 +258,48 @@ void MainWindow::on_actionRemove_triggered()
         _filterModel->removeRow(i->row());
 }
 
+void MainWindow::on_actionPause_triggered()
+{
+    ThreadPool::instance()->pause();
+}
+
+void MainWindow::on_actionResume_triggered()
+{
+    ThreadPool::instance()->resume();
+}
+
+void MainWindow::on_actionPauseTasks_triggered()
+{
+    for (const auto row : selectedTaskRows())
+        ThreadPool::instance()->setTaskPaused(row, true);
+}
+
+void MainWindow::on_actionResumeTasks_triggered()
+{
+    for (const auto row : selectedTaskRows())
+        ThreadPool::instance()->setTaskPaused(row, false);
+}
+
+void MainWindow::on_actionRunNext_triggered()
+{
+    // Each task goes in front of the previous one, so the first selected one starts first
+    const auto rows = selectedTaskRows();
+    for (auto i = rows.rbegin(); i != rows.rend(); ++i)
+        ThreadPool::instance()->runTaskNext(*i);
+}
+
+void MainWindow::on_actionRaisePriority_triggered()
+{
+    for (const auto row : selectedTaskRows())
+        ThreadPool::instance()->setTaskPriority(row, TaskManager::instance()->tasks().at(row)->priority() + 1);
+}
+
+void MainWindow::on_actionLowerPriority_triggered()
+{
+    for (const auto row : selectedTaskRows())
+        ThreadPool::instance()->setTaskPriority(row, TaskManager::instance()->tasks().at(row)->priority() - 1);
+}
+
 void MainWindow::on_actionStart_triggered()
 {
     if (Settings::instance().password().isEmpty() && !PasswordDialog(this).exec())
@@ -175,6 +320,89 @@ void MainWindow::on_actionPassword_triggered()
     PasswordDialog(this).exec();
 }
 
+void MainWindow::on_actionInPlace_toggled(bool checked)
+{
+    Settings::instance().setInPlace(checked);
+}
+
+void MainWindow::on_actionSecureDelete_toggled(bool checked)
+{
+    Settings::instance().setSecureDelete(checked);
+}
+
+void MainWindow::on_actionBypassPageCache_toggled(bool checked)
+{
+    Settings::instance().setBypassPageCache(checked);
+}
+
+void MainWindow::on_actionPackFolders_toggled(bool checked)
+{
+    Settings::instance().setPackFolders(checked);
+}
+
+void MainWindow::on_actionDeduplicate_toggled(bool checked)
+{
+    Settings::instance().setDeduplicate(checked);
+}
+
+void MainWindow::on_actionIncremental_toggled(bool checked)
+{
+    Settings::instance().setIncremental(checked);
+}
+
+void MainWindow::on_actionAddKeyringPassword_triggered()
+{
+    auto ok = false;
+    const auto password = QInputDialog::getText(this, actionAddKeyringPassword->text(), tr("Password:"), QLineEdit::Password, QString(), &ok);
+    if (!ok || password.isEmpty())
+        return;
+
+    if (!Settings::instance().addKeyringPassword(password))
+        QMessageBox::warning(this, QApplication::applicationName(), tr("Failed to derive the key from the password"));
+
+    actionClearKeyring->setEnabled(!Settings::instance().keyring().isEmpty());
+}
+
+void MainWindow::on_actionClearKeyring_triggered()
+{
+    Settings::instance().clearKeyring();
+    actionClearKeyring->setEnabled(false);
+}
+
+void MainWindow::on_actionWatchFolder_triggered()
+{
+    const auto folder = QFileDialog::getExistingDirectory(this, tr("Watch folder"));
+    if (folder.isEmpty())
+        return;
+
+    auto folders = Settings::instance().watchFolders();
+    if (folders.contains(folder))
+        return;
+
+    folders << folder;
+    Settings::instance().setWatchFolders(folders);
+    _folderWatcher->setFolders(folders);
+    actionStopWatching->setEnabled(true);
+}
+
+void MainWindow::on_actionStopWatching_triggered()
+{
+    Settings::instance().setWatchFolders(QStringList());
+    _folderWatcher->setFolders(QStringList());
+    actionStopWatching->setEnabled(false);
+}
+
+void MainWindow::on_actionLimits_triggered()
+{
+    LimitsDialog(this).exec();
+}
+
+void MainWindow::on_actionContinuous_toggled(bool checked)
+{
+    Settings::instance().setContinuous(checked);
+    actionStart->setEnabled(!TaskManager::instance()->tasks().isEmpty() || checked);
+}
+
 void MainWindow::on_actionAbout_triggered()
 {
     AboutDialog dialog(this);
@@ -186,7 +414,7 @@ void MainWindow::on_treeViewTasks_doubleClicked(const QModelIndex &index)
     if (!index.isValid())
         return;
 
-    const QPointer<Task> task(TaskManager::instance()->tasks().value(index.row()));
+    const QPointer<Task> task(TaskManager::instance()->tasks().value(_filterModel->mapToSource(index).row()));
     Q_ASSERT(task);
     QDesktopServices::openUrl(QUrl::fromLocalFile(QFileInfo(task->inputFile()).absolutePath()));
 }
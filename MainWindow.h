@@ -5,6 +5,7 @@
 
 #include "ui_MainWindow.h"
 
+class FolderWatcher;
 class TaskTableModel;
 class TaskFilterProxyModel;
 
@@ -24,19 +25,42 @@ protected:
 
 private:
     void addPath(const QString &path);
+    void addWatchedFiles(const QStringList &fileNames);
+    // Source rows of the selected tasks, in the order they are shown
+    QList<int> selectedTaskRows() const;
 
     static const QString _keyHeaderState;
 
     TaskTableModel *_model;
     TaskFilterProxyModel *_filterModel;
+    FolderWatcher *_folderWatcher;
 
     // GUI
     Q_SLOT void on_filterEdit_textChanged(const QString &text);
     Q_SLOT void on_actionAdd_triggered();
     Q_SLOT void on_actionRemove_triggered();
+    Q_SLOT void on_actionRunNext_triggered();
+    Q_SLOT void on_actionRaisePriority_triggered();
+    Q_SLOT void on_actionLowerPriority_triggered();
     Q_SLOT void on_actionStart_triggered();
     Q_SLOT void on_actionStop_triggered();
+    Q_SLOT void on_actionPause_triggered();
+    Q_SLOT void on_actionResume_triggered();
+    Q_SLOT void on_actionPauseTasks_triggered();
+    Q_SLOT void on_actionResumeTasks_triggered();
     Q_SLOT void on_actionPassword_triggered();
+    Q_SLOT void on_actionInPlace_toggled(bool checked);
+    Q_SLOT void on_actionSecureDelete_toggled(bool checked);
+    Q_SLOT void on_actionBypassPageCache_toggled(bool checked);
+    Q_SLOT void on_actionPackFolders_toggled(bool checked);
+    Q_SLOT void on_actionDeduplicate_toggled(bool checked);
+    Q_SLOT void on_actionIncremental_toggled(bool checked);
+    Q_SLOT void on_actionContinuous_toggled(bool checked);
+    Q_SLOT void on_actionAddKeyringPassword_triggered();
+    Q_SLOT void on_actionClearKeyring_triggered();
+    Q_SLOT void on_actionWatchFolder_triggered();
+    Q_SLOT void on_actionStopWatching_triggered();
+    Q_SLOT void on_actionLimits_triggered();
     Q_SLOT void on_actionAbout_triggered();
     Q_SLOT void on_treeViewTasks_doubleClicked(const QModelIndex &index);
 };
@@ -0,0 +1,241 @@
+#include "Manifest.h"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include "Crypto.h"
+#include "FileHeader.h"
+
+#ifndef Q_OS_WIN
+#include <sys/stat.h>
+#endif
+
+using namespace Crypto;
+
+static const quint32 manifestMagic   = 0x484d4e46; // "HMNF"
+static const quint32 manifestVersion = 2;
+
+static QDataStream& operator<<(QDataStream &stream, const Manifest::Entry &entry)
+{
+    return (stream << entry.size << entry.modified << entry.inode << entry.hash << entry.outputFile);
+}
+
+static QDataStream& operator>>(QDataStream &stream, Manifest::Entry &entry)
+{
+    return (stream >> entry.size >> entry.modified >> entry.inode >> entry.hash >> entry.outputFile);
+}
+
+// Manifest
+
+Manifest::Manifest()
+    : _modified(false)
+{}
+
+Manifest& Manifest::instance()
+{
+    static Manifest instance;
+
+    return instance;
+}
+
+bool Manifest::load(const QByteArray &key, QString &errorString)
+{
+    QMutexLocker locker(&_mutex);
+    if (!_fileName.isEmpty() && (key == _key))
+        return true;
+
+    _key = key;
+    _fileName.clear();
+    _entries.clear();
+    _modified = false;
+
+    const auto folder = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    if (!QDir().mkpath(folder)) {
+        errorString = QString("'%1': Unable to create the folder").arg(folder);
+
+        return false;
+    }
+
+    const QDir dir(folder);
+    for (const auto &i : dir.entryList({ "manifest-*" }, QDir::Files | QDir::Hidden)) {
+        auto matches = false;
+        // A damaged manifest only costs one full run, it is not worth failing for
+        if (!read(dir.filePath(i), matches))
+            _entries.clear();
+
+        if (matches) {
+            _fileName = dir.filePath(i);
+
+            return true;
+        }
+    }
+
+    try {
+        _fileName = dir.filePath(QString("manifest-%1").arg(QString::fromLatin1(Factory::randomBytes(8).toHex())));
+    } catch (const Exception &e) {
+        errorString = e.errorMessage();
+
+        return false;
+    }
+
+    return true;
+}
+
+bool Manifest::save(QString &errorString)
+{
+    QMutexLocker locker(&_mutex);
+    if (!_modified || _fileName.isEmpty())
+        return true;
+
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream << manifestMagic << manifestVersion << _entries;
+
+    QByteArray data;
+    try {
+        FileHeader header;
+        header.algorithm = Factory::preferredAlgorithm();
+        header.iv        = Factory::randomBytes(Factory::algorithmInfo(header.algorithm)->ivSize);
+        header.setKeyCheck(_key);
+
+        const auto dataKey = Factory::randomBytes(_key.size());
+        header.wrapKey(_key, dataKey);
+
+        auto cipher = Factory::instance().acquireCipher(dataKey, header.algorithm, header.iv, true);
+        cipher->setAad(header.aad());
+
+        data = header.toByteArray();
+        data += cipher->update(payload);
+        data += cipher->updateFinal();
+        data += cipher->tag();
+    } catch (const Exception &e) {
+        errorString = e.errorMessage();
+
+        return false;
+    }
+
+    QSaveFile file(_fileName);
+    if (!file.open(QFile::WriteOnly) || (file.write(data) != data.size()) || !file.commit()) {
+        errorString = QString("'%1': %2").arg(_fileName).arg(file.errorString());
+
+        return false;
+    }
+
+    _modified = false;
+
+    return true;
+}
+
+bool Manifest::fileState(const QString &filePath, Manifest::Entry &entry)
+{
+    // One stat() call: size, modification time and inode together
+#ifdef Q_OS_WIN
+    const QFileInfo fileInfo(filePath);
+    if (!fileInfo.exists())
+        return false;
+
+    entry.size     = fileInfo.size();
+    entry.modified = fileInfo.lastModified().toMSecsSinceEpoch();
+    entry.inode    = 0;
+#else
+    struct stat status;
+    if (0 != ::stat(QFile::encodeName(filePath).constData(), &status))
+        return false;
+
+    entry.size     = status.st_size;
+    entry.inode    = status.st_ino;
+#if defined(Q_OS_DARWIN)
+    entry.modified = qint64(status.st_mtimespec.tv_sec) * 1000000000 + status.st_mtimespec.tv_nsec;
+#else
+    entry.modified = qint64(status.st_mtim.tv_sec) * 1000000000 + status.st_mtim.tv_nsec;
+#endif
+#endif
+
+    return true;
+}
+
+QByteArray Manifest::fileHash(const QString &filePath)
+{
+    QFile file(filePath);
+    if (!file.open(QFile::ReadOnly))
+        return QByteArray();
+
+    try {
+        auto digest = Factory::instance().createDigest(Factory::SHA::SHA256);
+        while (!file.atEnd()) {
+            const auto data = file.read(1024 * 1024);
+            if (data.isEmpty())
+                return QByteArray();
+            digest->update(data);
+        }
+
+        return digest->updateFinal();
+    } catch (const Exception &) {
+        return QByteArray();
+    }
+}
+
+bool Manifest::find(const QString &filePath, Manifest::Entry &entry) const
+{
+    QMutexLocker locker(&_mutex);
+    const auto i = _entries.constFind(filePath);
+    if (_entries.constEnd() == i)
+        return false;
+
+    entry = i.value();
+
+    return true;
+}
+
+bool Manifest::read(const QString &fileName, bool &matches)
+{
+    matches = false;
+
+    QFile file(fileName);
+    FileHeader header;
+    if (!file.open(QFile::ReadOnly) || !FileHeader::hasMagic(file) || !header.read(file))
+        return false;
+
+    const auto info = Factory::algorithmInfo(header.algorithm);
+    if ((Q_NULLPTR == info) || (0 == info->tagSize))
+        return false;
+
+    QByteArray payload;
+    try {
+        matches = header.checkKey(_key);
+        if (!matches)
+            return true;
+
+        const auto data = file.readAll();
+        if (data.size() < info->tagSize)
+            return false;
+
+        auto cipher = Factory::instance().acquireCipher(header.unwrapKey(_key), header.algorithm, header.iv, false);
+        cipher->setTag(data.right(info->tagSize));
+        cipher->setAad(header.aad());
+        payload = cipher->update(data.left(data.size() - info->tagSize));
+        payload += cipher->updateFinal();
+    } catch (const Exception &) {
+        return false;
+    }
+
+    QDataStream stream(payload);
+    quint32 magic = 0, version = 0;
+    stream >> magic >> version;
+    if ((manifestMagic == magic) && (manifestVersion == version))
+        stream >> _entries;
+
+    return (QDataStream::Ok == stream.status());
+}
+
+void Manifest::update(const QString &filePath, const Manifest::Entry &entry)
+{
+    QMutexLocker locker(&_mutex);
+    _entries.insert(filePath, entry);
+    _modified = true;
+}
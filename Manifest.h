@@ -0,0 +1,51 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <QHash>
+#include <QMutex>
+#include <QString>
+
+// Manifest
+class Manifest
+{
+    Q_DISABLE_COPY(Manifest)
+
+private:
+    Manifest();
+    virtual ~Manifest() {}
+
+public:
+    struct Entry {
+        Entry() : size(-1), modified(0), inode(0) {}
+
+        qint64 size;
+        qint64 modified;
+        quint64 inode;
+        QByteArray hash;
+        QString outputFile;
+    };
+
+    static Manifest& instance();
+
+    // Every password has a manifest of its own: outputs made with another password don't count.
+    // Manifests are encrypted and have random names, the one whose key check the password passes is used
+    bool load(const QByteArray &key, QString &errorString);
+    bool save(QString &errorString);
+
+    static bool fileState(const QString &filePath, Manifest::Entry &entry);
+    static QByteArray fileHash(const QString &filePath);
+
+    bool find(const QString &filePath, Manifest::Entry &entry) const;
+    void update(const QString &filePath, const Manifest::Entry &entry);
+
+private:
+    bool read(const QString &fileName, bool &matches);
+
+    mutable QMutex _mutex;
+    QByteArray _key;
+    QString _fileName;
+    QHash<QString, Manifest::Entry> _entries;
+    bool _modified;
+};
+
+#endif // MANIFEST_H
@@ -1,8 +1,8 @@
 #include "PasswordDialog.h"
 
 #include "GeneratePasswordDialog.h"
+#include "PasswordStrength.h"
 #include "Settings.h"
-#include "Utils.h"
 
 // PasswordDialog
 
@@ -18,7 +18,9 @@ PasswordDialog::PasswordDialog(QWidget *parent)
 
     connect(lineEditPassword, &QLineEdit::textChanged, [this, updateControls] (const QString &text) {
         updateControls();
-        progressBar->setValue(Utils::passwordStrength(text));
+        const auto strength = PasswordStrength::evaluate(text);
+        progressBar->setValue(strength.level);
+        progressBar->setToolTip(tr("%1 bits").arg(qRound(strength.entropy)));
     });
     connect(lineEditConfirmPassword, &QLineEdit::textChanged, updateControls);
 }
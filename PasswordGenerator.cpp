@@ -1,39 +1,154 @@
 #include "PasswordGenerator.h"
 
+#include <QtConcurrent>
+
+#include "Crypto.h"
+
 #include <algorithm>
-#include <random>
+#include <cstring>
+
+namespace
+{
+    const int batchSize = 1024;
+
+    // Per-thread block of CSPRNG output, so a password costs a few memcpy()s instead of a RAND_bytes() call per character
+    class RandomBuffer
+    {
+    public:
+        RandomBuffer() : _position(blockSize) {}
+
+        quint32 next(const int size)
+        {
+            if (_position + size > blockSize) {
+                _block = Crypto::Factory::randomBytes(blockSize);
+                _position = 0;
+            }
+
+            quint32 value = 0;
+            std::memcpy(&value, _block.constData() + _position, size);
+            _position += size;
+
+            return value;
+        }
+
+    private:
+        static const int blockSize = 4096;
+
+        QByteArray _block;
+        int _position;
+    };
+
+    thread_local RandomBuffer randomBuffer;
+
+    template <typename Generator>
+    QStringList generateBatches(const int count, Generator generator)
+    {
+        QVector<int> batches;
+        for (auto i = 0; i < count; i += batchSize)
+            batches << i;
+
+        QVector<QString> results(count);
+        QtConcurrent::blockingMap(batches, [count, &results, &generator] (const int first) {
+            const auto last = std::min(first + batchSize, count);
+            for (auto i = first; i < last; ++i)
+                results[i] = generator();
+        });
+
+        return results.toList();
+    }
+}
 
 // PasswordGenerator
 
-QString PasswordGenerator::generate(Options option, int length)
+QString PasswordGenerator::generate(Options options, int length)
+{
+    Q_ASSERT(length > 5);
+
+    const auto symbols = alphabet(options);
+
+    QString password(length, Qt::Uninitialized);
+    for (auto &i : password)
+        i = symbols.at(uniform(symbols.length()));
+
+    return password;
+}
+
+QStringList PasswordGenerator::generate(Options options, int length, int count)
 {
     Q_ASSERT(length > 5);
+    Q_ASSERT(count >= 0);
+
+    const auto symbols = alphabet(options);
+
+    return generateBatches(count, [&symbols, length] () {
+        QString password(length, Qt::Uninitialized);
+        for (auto &i : password)
+            i = symbols.at(uniform(symbols.length()));
+
+        return password;
+    });
+}
+
+QString PasswordGenerator::generatePassphrase(const QStringList &words, int wordCount, const QString &separator)
+{
+    Q_ASSERT(!words.isEmpty());
+    Q_ASSERT(wordCount > 0);
+
+    QStringList passphrase;
+    passphrase.reserve(wordCount);
+    for (auto i = 0; i < wordCount; ++i)
+        passphrase << words.at(uniform(words.size()));
+
+    return passphrase.join(separator);
+}
+
+QStringList PasswordGenerator::generatePassphrases(const QStringList &words, int wordCount, const QString &separator, int count)
+{
+    Q_ASSERT(count >= 0);
+
+    return generateBatches(count, [&words, wordCount, &separator] () {
+        return generatePassphrase(words, wordCount, separator);
+    });
+}
 
+QString PasswordGenerator::alphabet(Options options)
+{
     QString symbols = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
 
-    if (option.testFlag(DigitsOption))
+    if (options.testFlag(DigitsOption))
         symbols += "0123456789";
 
-    if (option.testFlag(MinusOption))
+    if (options.testFlag(MinusOption))
         symbols += "-";
 
-    if (option.testFlag(UnderlineOption))
+    if (options.testFlag(UnderlineOption))
         symbols += "_";
 
-    if (option.testFlag(SpaceOption))
+    if (options.testFlag(SpaceOption))
         symbols += " ";
 
-    if (option.testFlag(SpecialOption))
+    if (options.testFlag(SpecialOption))
         symbols += "!@#$%^&*+=;:'\",./?\\|`~";
 
-    if (option.testFlag(BracketsOption))
+    if (options.testFlag(BracketsOption))
         symbols += "[]{}()<>";
 
-    while (symbols.length() < length)
-        symbols += symbols;
+    return symbols;
+}
+
+quint32 PasswordGenerator::uniform(quint32 bound)
+{
+    Q_ASSERT(bound > 0);
+
+    // Rejection sampling: values above the largest multiple of bound would favour the low indexes
+    const auto size = (bound <= 0x100) ? 1 : ((bound <= 0x10000) ? 2 : 4);
+    const auto range = Q_UINT64_C(1) << (8 * size);
+    const auto limit = range - range % bound;
 
-    static std::mt19937 engine((std::random_device())());
-    std::shuffle(symbols.begin(), symbols.end(), engine);
+    quint64 value;
+    do {
+        value = randomBuffer.next(size);
+    } while (value >= limit);
 
-    return symbols.left(length);
+    return static_cast<quint32>(value % bound);
 }
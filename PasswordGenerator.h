@@ -1,7 +1,7 @@
 #ifndef PASSWORDGENERATOR_H
 #define PASSWORDGENERATOR_H
 
-#include <QString>
+#include <QStringList>
 
 // PasswordGenerator
 class PasswordGenerator
@@ -25,6 +25,14 @@ public:
     Q_DECLARE_FLAGS(Options, Option)
 
     static QString generate(Options options, int length);
+    static QStringList generate(Options options, int length, int count);
+
+    static QString generatePassphrase(const QStringList &words, int wordCount, const QString &separator);
+    static QStringList generatePassphrases(const QStringList &words, int wordCount, const QString &separator, int count);
+
+private:
+    static QString alphabet(Options options);
+    static quint32 uniform(quint32 bound);
 };
 
 #endif // PASSWORDGENERATOR_H
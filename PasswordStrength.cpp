@@ -0,0 +1,249 @@
+#include "PasswordStrength.h"
+
+#include <QSet>
+#include <QtConcurrent>
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    enum CharClass : quint8 {
+        LowerClass  = 1 << 0,
+        UpperClass  = 1 << 1,
+        DigitClass  = 1 << 2,
+        SymbolClass = 1 << 3,
+        OtherClass  = 1 << 4
+    };
+
+    const int lowerSize  = 26;
+    const int upperSize  = 26;
+    const int digitSize  = 10;
+    const int symbolSize = 33; // printable ASCII punctuation and space
+    const int otherSize  = 100;
+
+    // Bits a character is worth when it continues a repeat, a sequence or a keyboard walk
+    const double repeatEntropy   = 1.0;
+    const double sequenceEntropy = 1.0;
+    const double keyboardEntropy = 1.5;
+
+    const int maxWordLength = 16;
+
+    struct Tables {
+        quint8 charClass[128];
+        quint8 keyboardRow[128];
+        qint8 keyboardColumn[128];
+        char unleet[128];
+        QSet<QString> words;
+
+        Tables()
+        {
+            for (auto i = 0; i < 128; ++i) {
+                if ((i >= 'a') && (i <= 'z'))
+                    charClass[i] = LowerClass;
+                else if ((i >= 'A') && (i <= 'Z'))
+                    charClass[i] = UpperClass;
+                else if ((i >= '0') && (i <= '9'))
+                    charClass[i] = DigitClass;
+                else if ((i >= 0x20) && (i < 0x7f))
+                    charClass[i] = SymbolClass;
+                else
+                    charClass[i] = OtherClass;
+
+                keyboardRow[i] = 0;
+                keyboardColumn[i] = -1;
+                unleet[i] = ((i >= 'A') && (i <= 'Z')) ? static_cast<char>(i - 'A' + 'a') : static_cast<char>(i);
+            }
+
+            static const char *rows[] = { "`1234567890-=", "qwertyuiop[]\\", "asdfghjkl;'", "zxcvbnm,./" };
+            for (auto row = 0; row < 4; ++row) {
+                for (auto column = 0; rows[row][column]; ++column) {
+                    const auto key = static_cast<uchar>(rows[row][column]);
+                    keyboardRow[key] = static_cast<quint8>(row + 1);
+                    keyboardColumn[key] = static_cast<qint8>(column);
+                    if ((key >= 'a') && (key <= 'z')) {
+                        keyboardRow[key - 'a' + 'A'] = keyboardRow[key];
+                        keyboardColumn[key - 'a' + 'A'] = keyboardColumn[key];
+                    }
+                }
+            }
+
+            static const char *substitutions[][2] = { { "0", "o" }, { "1", "l" }, { "3", "e" }, { "4", "a" }, { "5", "s" }, { "7", "t" }, { "8", "b" }, { "@", "a" }, { "$", "s" }, { "!", "i" } };
+            for (const auto &i : substitutions)
+                unleet[static_cast<uchar>(i[0][0])] = i[1][0];
+
+            static const char *dictionary[] = {
+                "password", "passwd", "qwerty", "letmein", "welcome", "admin", "administrator", "root", "login",
+                "monkey", "dragon", "master", "shadow", "sunshine", "princess", "football", "baseball", "soccer",
+                "hockey", "batman", "superman", "trustno", "iloveyou", "starwars", "whatever", "freedom", "secret",
+                "michael", "jennifer", "jordan", "hunter", "ranger", "buster", "harley", "thomas", "robert",
+                "summer", "winter", "spring", "autumn", "january", "february", "march", "april", "june", "july",
+                "august", "september", "october", "november", "december", "monday", "friday", "sunday", "hello",
+                "charlie", "pepper", "ginger", "cookie", "cheese", "chocolate", "computer", "internet", "google",
+                "samsung", "apple", "orange", "banana", "flower", "love", "lovely", "angel", "killer", "hacker",
+                "changeme", "default", "guest", "test", "testing", "user", "access", "service", "server", "backup",
+                "oracle", "mysql", "postgres", "database", "system", "manager", "support", "office", "company",
+                "abc", "asdf", "zxcv", "qazwsx", "azerty", "haralug"
+            };
+            for (const auto i : dictionary)
+                words.insert(QString::fromLatin1(i));
+        }
+    };
+
+    const Tables& tables()
+    {
+        static const Tables tables;
+
+        return tables;
+    }
+
+    inline quint8 classOf(const Tables &t, const ushort c)
+    {
+        return (c < 128) ? t.charClass[c] : static_cast<quint8>(OtherClass);
+    }
+
+    inline bool isKeyboardStep(const Tables &t, const ushort a, const ushort b, const int direction)
+    {
+        return (a < 128) && (b < 128) && (0 != t.keyboardRow[a]) && (t.keyboardRow[a] == t.keyboardRow[b])
+            && (t.keyboardColumn[b] - t.keyboardColumn[a] == direction);
+    }
+}
+
+// PasswordStrength
+
+PasswordStrength::Result PasswordStrength::evaluate(const QString &password)
+{
+    return evaluate(reinterpret_cast<const ushort*>(password.utf16()), password.length());
+}
+
+PasswordStrength::Result PasswordStrength::evaluate(const ushort *password, const int length)
+{
+    if (length <= 0)
+        return Result { 0.0, 0 };
+
+    const auto &t = tables();
+
+    quint8 classes = 0;
+    for (auto i = 0; i < length; ++i)
+        classes |= classOf(t, password[i]);
+
+    auto poolSize = 0;
+    if (classes & LowerClass)
+        poolSize += lowerSize;
+    if (classes & UpperClass)
+        poolSize += upperSize;
+    if (classes & DigitClass)
+        poolSize += digitSize;
+    if (classes & SymbolClass)
+        poolSize += symbolSize;
+    if (classes & OtherClass)
+        poolSize += otherSize;
+
+    const auto charEntropy = std::log2(static_cast<double>(poolSize));
+
+    // Dictionary words survive common decorations: surrounding digits and symbols, capitals and l33t
+    auto first = 0, last = length;
+    while ((first < last) && !(classOf(t, password[first]) & (LowerClass | UpperClass)))
+        ++first;
+    while ((last > first) && !(classOf(t, password[last - 1]) & (LowerClass | UpperClass)))
+        --last;
+
+    // Each character is charged either the full pool or, when an attacker's pattern rules would predict it, a couple of bits
+    auto entropy = 0.0, wordCharsEntropy = 0.0;
+    for (auto i = 0; i < length; ++i) {
+        auto cost = charEntropy;
+        if (i > 0) {
+            const int current = password[i], previous = password[i - 1];
+            if (current == previous) {
+                cost = repeatEntropy;
+            } else if (i >= 2) {
+                const int beforePrevious = password[i - 2];
+                const auto step = current - previous;
+                if (((1 == step) || (-1 == step)) && (previous - beforePrevious == step) && (classOf(t, current) == classOf(t, previous)))
+                    cost = sequenceEntropy;
+                else if ((isKeyboardStep(t, previous, current, 1) && isKeyboardStep(t, beforePrevious, previous, 1))
+                         || (isKeyboardStep(t, previous, current, -1) && isKeyboardStep(t, beforePrevious, previous, -1)))
+                    cost = keyboardEntropy;
+            }
+            cost = std::min(cost, charEntropy);
+        }
+
+        entropy += cost;
+        if ((i >= first) && (i < last))
+            wordCharsEntropy += cost;
+    }
+
+    const auto wordLength = last - first;
+    if ((wordLength >= 3) && (wordLength <= maxWordLength)) {
+        ushort word[maxWordLength];
+        auto leet = false, capitals = false, ascii = true;
+        for (auto i = 0; ascii && (i < wordLength); ++i) {
+            const auto c = password[first + i];
+            ascii = (c < 128);
+            if (!ascii)
+                break;
+            word[i] = static_cast<ushort>(t.unleet[c]);
+            if (classOf(t, c) & UpperClass)
+                capitals = true;
+            else if (word[i] != c)
+                leet = true;
+        }
+
+        if (ascii && t.words.contains(QString::fromRawData(reinterpret_cast<const QChar*>(word), wordLength))) {
+            // A known word costs picking it from the dictionary plus a bit per decoration style, not its letters
+            const auto wordEntropy = std::log2(static_cast<double>(t.words.size())) + (leet ? 1.0 : 0.0) + (capitals ? 1.0 : 0.0);
+            if (wordEntropy < wordCharsEntropy)
+                entropy += wordEntropy - wordCharsEntropy;
+        }
+    }
+
+    return Result { entropy, level(entropy) };
+}
+
+QVector<PasswordStrength::Result> PasswordStrength::evaluate(const QStringList &passwords)
+{
+    QVector<Result> results(passwords.size());
+
+    static const int batchSize = 4096;
+    QVector<int> batches;
+    for (auto i = 0; i < passwords.size(); i += batchSize)
+        batches << i;
+
+    QtConcurrent::blockingMap(batches, [&passwords, &results] (const int first) {
+        const auto last = std::min(first + batchSize, passwords.size());
+        for (auto i = first; i < last; ++i)
+            results[i] = evaluate(passwords.at(i));
+    });
+
+    return results;
+}
+
+QVector<int> PasswordStrength::audit(const QStringList &passwords, const PasswordStrength::Policy &policy)
+{
+    const auto results = evaluate(passwords);
+
+    QVector<int> violations;
+    for (auto i = 0; i < results.size(); ++i) {
+        if ((passwords.at(i).length() < policy.minimumLength) || (results.at(i).entropy < policy.minimumEntropy))
+            violations << i;
+    }
+
+    return violations;
+}
+
+int PasswordStrength::level(const double entropy)
+{
+    if (entropy <= 0.0)
+        return 0;
+
+    if (entropy >= 128)
+        return 4;
+
+    if (entropy >= 64)
+        return 3;
+
+    if (entropy >= 56)
+        return 2;
+
+    return 1;
+}
@@ -0,0 +1,35 @@
+#ifndef PASSWORDSTRENGTH_H
+#define PASSWORDSTRENGTH_H
+
+#include <QStringList>
+#include <QVector>
+
+// PasswordStrength
+class PasswordStrength
+{
+    Q_DISABLE_COPY(PasswordStrength)
+
+private:
+    PasswordStrength() {}
+    virtual ~PasswordStrength() {}
+
+public:
+    struct Result {
+        double entropy;
+        int level;
+    };
+
+    struct Policy {
+        int minimumLength;
+        double minimumEntropy;
+    };
+
+    static PasswordStrength::Result evaluate(const QString &password);
+    static PasswordStrength::Result evaluate(const ushort *password, const int length);
+    static QVector<PasswordStrength::Result> evaluate(const QStringList &passwords);
+    static QVector<int> audit(const QStringList &passwords, const PasswordStrength::Policy &policy);
+
+    static int level(const double entropy);
+};
+
+#endif // PASSWORDSTRENGTH_H
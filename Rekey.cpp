@@ -0,0 +1,86 @@
+#include "Rekey.h"
+
+#include <QFile>
+
+#include "Archive.h"
+#include "Crypto.h"
+#include "FileHeader.h"
+#include "ThreadPool.h"
+#include "Utils.h"
+
+using namespace Crypto;
+
+// Rekey
+
+bool Rekey::rekeyFile(const QString &fileName, const Rekey::Keys &oldKeys, const Rekey::Keys &newKeys, QString &errorString)
+{
+    QFile file(fileName);
+    if (!file.open(QFile::ReadWrite)) {
+        errorString = file.errorString();
+
+        return false;
+    }
+
+    // Copies, chunk lists and the chunk store key start with the header, archives have it behind their own prefix
+    // and files encrypted in place end with it
+    FileHeader header;
+    QByteArray trailer;
+    auto headerOffset = FileHeader::hasMagic(file) ? 0 : ArchiveReader::keyHeaderOffset(file);
+    if ((headerOffset < 0) && TaskJob::readInPlaceTrailer(file, trailer, header)) {
+        // The journal of a file that is being decrypted in place still holds the old trailer
+        if (QFile::exists(fileName + TaskJob::journalFileExt)) {
+            errorString = "The file is being transformed in place";
+
+            return false;
+        }
+
+        headerOffset = file.size() - trailer.size();
+    }
+
+    if ((headerOffset < 0) || (trailer.isEmpty() && (!file.seek(headerOffset) || !FileHeader::hasMagic(file) || !header.read(file)))) {
+        errorString = "Unsupported file format";
+
+        return false;
+    }
+
+    const auto headerSize = trailer.isEmpty() ? (file.pos() - headerOffset) : trailer.size();
+
+    try {
+        // A file that already carries the new password is left alone, so an interrupted run can simply be repeated
+        if (header.checkKey(newKeys.key)) {
+            header.unwrapKey(newKeys.key);
+
+            return true;
+        }
+
+        if (!header.checkKey(oldKeys.key)) {
+            errorString = "Wrong password";
+
+            return false;
+        }
+
+        const auto dataKey = header.unwrapKey(oldKeys.key);
+        header.setKeyCheck(newKeys.key);
+        header.wrapKey(newKeys.key, dataKey);
+    } catch (const Exception &e) {
+        errorString = e.errorMessage();
+
+        return false;
+    }
+
+    // The key check and key slot have fixed sizes, so the new header overwrites the old one in place
+    const auto headerData = trailer.isEmpty() ? header.toByteArray() : TaskJob::inPlaceTrailer(header);
+    if (headerData.size() != headerSize) {
+        errorString = "The new header doesn't fit in place of the old one";
+
+        return false;
+    }
+
+    if (!file.seek(headerOffset) || (file.write(headerData) != headerData.size()) || !Utils::syncFile(file)) {
+        errorString = file.errorString();
+
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,26 @@
+#ifndef REKEY_H
+#define REKEY_H
+
+#include <QByteArray>
+#include <QString>
+
+#include "Settings.h"
+
+// Rekey
+class Rekey
+{
+    Q_DISABLE_COPY(Rekey)
+
+private:
+    Rekey() {}
+    virtual ~Rekey() {}
+
+public:
+    using Keys = Settings::Keys;
+
+    // Rewraps the data key of an encrypted file, an archive or the chunk store key for a new password;
+    // only the header is rewritten
+    static bool rekeyFile(const QString &fileName, const Rekey::Keys &oldKeys, const Rekey::Keys &newKeys, QString &errorString);
+};
+
+#endif // REKEY_H
@@ -3,6 +3,7 @@
 #include <QApplication>
 #include <QSettings>
 
+#include "ChunkStore.h"
 #include "Crypto.h"
 #include "ThreadPool.h"
 
@@ -10,10 +11,42 @@ using namespace Crypto;
 
 // Settings
 
+const QString Settings::_keyInPlace          = "inPlace";
+const QString Settings::_keySecureDelete     = "secureDelete";
+const QString Settings::_keyBypassPageCache  = "bypassPageCache";
+const QString Settings::_keyPackFolders      = "packFolders";
+const QString Settings::_keyDeduplicate      = "deduplicate";
+const QString Settings::_keyChunkStoreFolder = "chunkStoreFolder";
+const QString Settings::_keyIncremental      = "incremental";
+const QString Settings::_keyContinuous       = "continuous";
+const QString Settings::_keyWatchFolders     = "watchFolders";
+const QString Settings::_keyMaxSpeed         = "maxSpeed";
+const QString Settings::_keyMaxWorkers       = "maxWorkers";
+const QString Settings::_keyNiceness         = "niceness";
+const QString Settings::_keyIoPriority       = "ioPriority";
+const QString Settings::_keyPinWorkers       = "pinWorkers";
+const QString Settings::_keyBufferMemory     = "bufferMemory";
+
 Settings::Settings()
     : QObject()
     , _settings(new QSettings(this))
-{}
+{
+    _inPlace          = _settings->value(_keyInPlace, false).toBool();
+    _secureDelete     = _settings->value(_keySecureDelete, false).toBool();
+    _bypassPageCache  = _settings->value(_keyBypassPageCache, false).toBool();
+    _packFolders      = _settings->value(_keyPackFolders, false).toBool();
+    _deduplicate      = _settings->value(_keyDeduplicate, false).toBool();
+    _chunkStoreFolder = _settings->value(_keyChunkStoreFolder, ChunkStore::defaultFolder()).toString();
+    _incremental      = _settings->value(_keyIncremental, false).toBool();
+    _continuous       = _settings->value(_keyContinuous, false).toBool();
+    _watchFolders     = _settings->value(_keyWatchFolders).toStringList();
+    _maxSpeed         = _settings->value(_keyMaxSpeed, 0).toInt();
+    _maxWorkers       = _settings->value(_keyMaxWorkers, 0).toInt();
+    _niceness         = _settings->value(_keyNiceness, 0).toInt();
+    _ioPriority       = _settings->value(_keyIoPriority, static_cast<int>(Utils::IoPriority::Normal)).toInt();
+    _pinWorkers       = _settings->value(_keyPinWorkers, false).toBool();
+    _bufferMemory     = _settings->value(_keyBufferMemory, 64).toInt();
+}
 
 Settings& Settings::instance()
 {
@@ -29,6 +62,7 @@ bool Settings::setPassword(const QString &password)
     if (password != _password) {
         try {
             _signature = Factory::sign(QApplication::applicationName().toUtf8(), password);
+            _key = Factory::deriveKey(password);
             _password = password;
         } catch (...) {
             return false;
@@ -38,6 +72,133 @@ bool Settings::setPassword(const QString &password)
     return true;
 }
 
+bool Settings::addKeyringPassword(const QString &password)
+{
+    Q_ASSERT(ThreadPool::State::Stopped == ThreadPool::instance()->state());
+
+    try {
+        Keys keys;
+        keys.signature = Factory::sign(QApplication::applicationName().toUtf8(), password);
+        for (const auto &i : _keyring) {
+            if (i.signature == keys.signature)
+                return true;
+        }
+
+        keys.key = Factory::deriveKey(password);
+        _keyring.append(keys);
+    } catch (...) {
+        return false;
+    }
+
+    return true;
+}
+
+void Settings::clearKeyring()
+{
+    Q_ASSERT(ThreadPool::State::Stopped == ThreadPool::instance()->state());
+
+    _keyring.clear();
+}
+
+QVector<Settings::Keys> Settings::decryptionKeys() const
+{
+    QVector<Keys> keys;
+    keys.reserve(_keyring.size() + 1);
+    if (!_key.isEmpty())
+        keys.append({ _key, _signature });
+
+    for (const auto &i : _keyring) {
+        if (i.signature != _signature)
+            keys.append(i);
+    }
+
+    return keys;
+}
+
+void Settings::setInPlace(const bool inPlace)
+{
+    Q_ASSERT(ThreadPool::State::Stopped == ThreadPool::instance()->state());
+
+    _settings->setValue(_keyInPlace, _inPlace = inPlace);
+}
+
+void Settings::setSecureDelete(const bool secureDelete)
+{
+    Q_ASSERT(ThreadPool::State::Stopped == ThreadPool::instance()->state());
+
+    _settings->setValue(_keySecureDelete, _secureDelete = secureDelete);
+}
+
+void Settings::setBypassPageCache(const bool bypassPageCache)
+{
+    Q_ASSERT(ThreadPool::State::Stopped == ThreadPool::instance()->state());
+
+    _settings->setValue(_keyBypassPageCache, _bypassPageCache = bypassPageCache);
+}
+
+void Settings::setPackFolders(const bool packFolders)
+{
+    Q_ASSERT(ThreadPool::State::Stopped == ThreadPool::instance()->state());
+
+    _settings->setValue(_keyPackFolders, _packFolders = packFolders);
+}
+
+void Settings::setDeduplicate(const bool deduplicate)
+{
+    Q_ASSERT(ThreadPool::State::Stopped == ThreadPool::instance()->state());
+
+    _settings->setValue(_keyDeduplicate, _deduplicate = deduplicate);
+}
+
+void Settings::setIncremental(const bool incremental)
+{
+    Q_ASSERT(ThreadPool::State::Stopped == ThreadPool::instance()->state());
+
+    _settings->setValue(_keyIncremental, _incremental = incremental);
+}
+
+void Settings::setContinuous(const bool continuous)
+{
+    Q_ASSERT(ThreadPool::State::Stopped == ThreadPool::instance()->state());
+
+    _settings->setValue(_keyContinuous, _continuous = continuous);
+}
+
+void Settings::setWatchFolders(const QStringList &watchFolders)
+{
+    _settings->setValue(_keyWatchFolders, _watchFolders = watchFolders);
+}
+
+void Settings::setMaxSpeed(const int maxSpeed)
+{
+    _settings->setValue(_keyMaxSpeed, _maxSpeed = maxSpeed);
+}
+
+void Settings::setMaxWorkers(const int maxWorkers)
+{
+    _settings->setValue(_keyMaxWorkers, _maxWorkers = maxWorkers);
+}
+
+void Settings::setNiceness(const int niceness)
+{
+    _settings->setValue(_keyNiceness, _niceness = niceness);
+}
+
+void Settings::setIoPriority(const Utils::IoPriority ioPriority)
+{
+    _settings->setValue(_keyIoPriority, _ioPriority = static_cast<int>(ioPriority));
+}
+
+void Settings::setPinWorkers(const bool pinWorkers)
+{
+    _settings->setValue(_keyPinWorkers, _pinWorkers = pinWorkers);
+}
+
+void Settings::setBufferMemory(const int bufferMemory)
+{
+    _settings->setValue(_keyBufferMemory, _bufferMemory = bufferMemory);
+}
+
 QVariant Settings::value(const QString &key, const QVariant &defaultValue)
 {
     return _settings->value(key, defaultValue);
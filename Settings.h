@@ -2,7 +2,13 @@
 #define SETTINGS_H
 
 #include <QObject>
+#include <QStringList>
 #include <QVariant>
+#include <QVector>
+
+#include <atomic>
+
+#include "Utils.h"
 
 class QSettings;
 
@@ -18,18 +24,113 @@ private:
 public:
     static Settings& instance();
 
+    struct Keys {
+        QByteArray key;
+        QByteArray signature;
+    };
+
     const QString& password() const { return _password; }
     bool setPassword(const QString &password);
 
     const QByteArray& signature() const { return _signature; }
+    const QByteArray& key() const { return _key; }
+
+    // Extra passwords that are only tried for decryption, they are kept in memory only
+    const QVector<Settings::Keys>& keyring() const { return _keyring; }
+    bool addKeyringPassword(const QString &password);
+    void clearKeyring();
+    // The current password first, then the keyring
+    QVector<Settings::Keys> decryptionKeys() const;
+
+    bool inPlace() const { return _inPlace; }
+    void setInPlace(const bool inPlace);
+
+    bool secureDelete() const { return _secureDelete; }
+    void setSecureDelete(const bool secureDelete);
+
+    bool bypassPageCache() const { return _bypassPageCache; }
+    void setBypassPageCache(const bool bypassPageCache);
+
+    bool packFolders() const { return _packFolders; }
+    void setPackFolders(const bool packFolders);
+
+    bool deduplicate() const { return _deduplicate; }
+    void setDeduplicate(const bool deduplicate);
+
+    bool incremental() const { return _incremental; }
+    void setIncremental(const bool incremental);
+
+    const QString& chunkStoreFolder() const { return _chunkStoreFolder; }
+
+    // The queue keeps running when it runs out of tasks and starts new ones as they are added
+    bool continuous() const { return _continuous; }
+    void setContinuous(const bool continuous);
+
+    // New files in these folders are added as tasks, see FolderWatcher
+    const QStringList& watchFolders() const { return _watchFolders; }
+    void setWatchFolders(const QStringList &watchFolders);
+
+    // The limits can be changed while the tasks are running, see ThreadPool::applyLimits()
+    int maxSpeed() const { return _maxSpeed; }
+    void setMaxSpeed(const int maxSpeed);
+
+    int maxWorkers() const { return _maxWorkers; }
+    void setMaxWorkers(const int maxWorkers);
+
+    int niceness() const { return _niceness; }
+    void setNiceness(const int niceness);
+
+    Utils::IoPriority ioPriority() const { return static_cast<Utils::IoPriority>(_ioPriority.load()); }
+    void setIoPriority(const Utils::IoPriority ioPriority);
+
+    // Megabytes of chunk buffers shared by all workers, read once at the first task, see BufferPool
+    int bufferMemory() const { return _bufferMemory; }
+    void setBufferMemory(const int bufferMemory);
+
+    // Workers run on the NUMA node of the disk that holds the input file
+    bool pinWorkers() const { return _pinWorkers; }
+    void setPinWorkers(const bool pinWorkers);
 
     QVariant value(const QString &key, const QVariant &defaultValue = QVariant());
     void setValue(const QString &key, const QVariant &value);
 
 private:
+    static const QString _keyInPlace;
+    static const QString _keySecureDelete;
+    static const QString _keyBypassPageCache;
+    static const QString _keyPackFolders;
+    static const QString _keyDeduplicate;
+    static const QString _keyChunkStoreFolder;
+    static const QString _keyIncremental;
+    static const QString _keyContinuous;
+    static const QString _keyWatchFolders;
+    static const QString _keyMaxSpeed;
+    static const QString _keyMaxWorkers;
+    static const QString _keyNiceness;
+    static const QString _keyIoPriority;
+    static const QString _keyPinWorkers;
+    static const QString _keyBufferMemory;
+
     QString _password;
     QByteArray _signature;
+    QByteArray _key;
+    QVector<Settings::Keys> _keyring;
     QSettings *_settings;
+    bool _inPlace;
+    bool _secureDelete;
+    bool _bypassPageCache;
+    bool _packFolders;
+    bool _deduplicate;
+    QString _chunkStoreFolder;
+    bool _incremental;
+    bool _continuous;
+    QStringList _watchFolders;
+    std::atomic_int _maxSpeed;
+    std::atomic_int _maxWorkers;
+    std::atomic_int _niceness;
+    std::atomic_int _ioPriority;
+    std::atomic_bool _pinWorkers;
+    std::atomic_int _bufferMemory;
 };
 
 #endif // SETTINGS_H
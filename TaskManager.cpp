@@ -1,5 +1,6 @@
 #include "TaskManager.h"
 
+#include <QFileInfo>
 #include <QPointer>
 
 #include "ThreadPool.h"
@@ -9,10 +10,38 @@
 Task::Task(const QString &inputFile, QObject *parent)
     : QObject(parent)
     , _inputFile(inputFile)
+    , _size(QFileInfo(inputFile).isFile() ? QFileInfo(inputFile).size() : 0)
     , _progress(0)
+    , _priority(0)
     , _state(State::New)
+    , _elapsed(0)
 {}
 
+qint64 Task::bytesDone() const
+{
+    switch (_state) {
+        case State::Running: // fall through
+        case State::Paused:
+            return _size * _progress / 100;
+        case State::Succeded:
+            return _size;
+        default:
+            return 0;
+    }
+}
+
+qint64 Task::elapsed() const
+{
+    return ((State::Running == _state) ? _elapsed + _timer.elapsed() : _elapsed);
+}
+
+double Task::speed() const
+{
+    const auto milliseconds = elapsed();
+
+    return ((milliseconds > 0) ? 1000.0 * bytesDone() / milliseconds : 0.0);
+}
+
 void Task::setOutputFile(const QString &outputFile)
 {
     if (outputFile != _outputFile)
@@ -31,10 +60,27 @@ void Task::setProgress(const int progress)
         Q_EMIT progressChanged(_progress = progress);
 }
 
+void Task::setPriority(const int priority)
+{
+    if (priority != _priority)
+        Q_EMIT priorityChanged(_priority = priority);
+}
+
 void Task::setState(const Task::State state)
 {
-    if (state != _state)
-        Q_EMIT stateChanged(_state = state);
+    if (state == _state)
+        return;
+
+    if (State::Running == state) {
+        _timer.start();
+    } else if (State::Running == _state) {
+        _elapsed += _timer.elapsed();
+    }
+
+    if ((State::New == state) || (State::Queued == state))
+        _elapsed = 0;
+
+    Q_EMIT stateChanged(_state = state);
 }
 
 // TaskManager
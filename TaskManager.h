@@ -1,6 +1,7 @@
 #ifndef TASKMANAGER_H
 #define TASKMANAGER_H
 
+#include <QElapsedTimer>
 #include <QList>
 #include <QObject>
 
@@ -21,11 +22,20 @@ public:
         Queued,
         Running,
         Succeded,
-        Failed
+        Failed,
+        Paused
     };
 
     const QString& inputFile() const { return _inputFile; }
 
+    // The size of the input file when the task was added
+    qint64 size() const { return _size; }
+    qint64 bytesDone() const;
+    // Milliseconds spent running, so far or in total
+    qint64 elapsed() const;
+    // Bytes per second
+    double speed() const;
+
     QString outputFile() const { return _outputFile; }
     Q_SLOT void setOutputFile(const QString &outputFile);
     Q_SIGNAL void outputFileChanged(const QString &outputFile);
@@ -38,6 +48,11 @@ public:
     Q_SLOT void setProgress(const int progress);
     Q_SIGNAL void progressChanged(const int progress);
 
+    // Higher priorities are started first
+    int priority() const { return _priority; }
+    Q_SLOT void setPriority(const int priority);
+    Q_SIGNAL void priorityChanged(const int priority);
+
     Task::State state() const { return _state; }
     Q_SLOT void setState(const Task::State state);
     Q_SIGNAL void stateChanged(const Task::State state);
@@ -46,10 +61,14 @@ public:
 
 private:
     const QString _inputFile;
+    const qint64 _size;
     QString _outputFile;
     QString _lastError;
     int _progress;
+    int _priority;
     Task::State _state;
+    QElapsedTimer _timer;
+    qint64 _elapsed;
 };
 
 Q_DECLARE_METATYPE(Task::State)
@@ -69,7 +88,7 @@ private:
 public:
     static TaskManager* instance();
 
-    TaskList tasks() const { return _tasks; }
+    const TaskList& tasks() const { return _tasks; }
 
     void addTask(const QString &inputFile);
     Q_SIGNAL void taskAdded();
@@ -1,10 +1,11 @@
 #include "TaskProgressItemDelegate.h"
 
 #include <QApplication>
-#include <QPointer>
+#include <QPainter>
+#include <QPixmapCache>
 #include <QStyleOptionProgressBar>
 
-#include "TaskManager.h"
+#include "TaskTableModel.h"
 
 // TaskProgressItemDelegate
 
@@ -19,21 +20,46 @@ void TaskProgressItemDelegate::paint(QPainter *painter, const QStyleOptionViewIt
     itemOption.state &= ~QStyle::State_HasFocus;
     QStyledItemDelegate::paint(painter, itemOption, index);
 
-    if (index.isValid() && (_column == index.column())) {
-        QPointer<Task> task(TaskManager::instance()->tasks().value(index.row()));
-        if (task && (Task::State::Running == task->state())) {
-            auto widget = qobject_cast<QWidget*>(itemOption.styleObject);
-            Q_CHECK_PTR(widget);
-
-            static QStyleOptionProgressBar progressBarOption;
-            progressBarOption.initFrom(widget);
-            progressBarOption.rect = itemOption.rect.adjusted(2, 2, -2, -2);
-            progressBarOption.state = itemOption.state;
-            progressBarOption.minimum = 0;
-            progressBarOption.maximum = 100;
-            progressBarOption.progress = task->progress();
-
-            QApplication::style()->drawControl(QStyle::CE_ProgressBar, &progressBarOption, painter);
-        }
+    if (!index.isValid() || (_column != index.column()))
+        return;
+
+    // The index may belong to the filter model, so the progress is taken from the data rather than from the task list
+    const auto progress = index.data(TaskTableModel::ProgressRole);
+    if (!progress.isValid())
+        return;
+
+    const auto rect = itemOption.rect.adjusted(2, 2, -2, -2);
+    if (rect.isEmpty())
+        return;
+
+    // Only a hundred different bars are ever drawn for a given size, so the style is asked once for each of them
+    const auto state = itemOption.state & (QStyle::State_Enabled | QStyle::State_Active | QStyle::State_Selected);
+    const auto key = QString("TaskProgress:%1:%2x%3:%4").arg(progress.toInt()).arg(rect.width()).arg(rect.height()).arg(static_cast<int>(state));
+
+    QPixmap pixmap;
+    if (!QPixmapCache::find(key, &pixmap)) {
+        auto widget = qobject_cast<QWidget*>(itemOption.styleObject);
+        Q_CHECK_PTR(widget);
+
+        const auto ratio = painter->device()->devicePixelRatioF();
+        pixmap = QPixmap(rect.size() * ratio);
+        pixmap.setDevicePixelRatio(ratio);
+        pixmap.fill(Qt::transparent);
+
+        QStyleOptionProgressBar progressBarOption;
+        progressBarOption.initFrom(widget);
+        progressBarOption.rect = QRect(QPoint(), rect.size());
+        progressBarOption.state = itemOption.state;
+        progressBarOption.minimum = 0;
+        progressBarOption.maximum = 100;
+        progressBarOption.progress = progress.toInt();
+
+        QPainter pixmapPainter(&pixmap);
+        QApplication::style()->drawControl(QStyle::CE_ProgressBar, &progressBarOption, &pixmapPainter, widget);
+        pixmapPainter.end();
+
+        QPixmapCache::insert(key, pixmap);
     }
+
+    painter->drawPixmap(rect.topLeft(), pixmap);
 }
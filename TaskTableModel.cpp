@@ -2,6 +2,12 @@
 
 #include <QPersistentModelIndex>
 #include <QPointer>
+#include <QRegularExpression>
+#include <QTimer>
+#include <QtConcurrent>
+
+#include <algorithm>
+#include <cmath>
 
 #include "TaskManager.h"
 
@@ -10,7 +16,12 @@
 const QVariantList TaskTableModel::_headerData = {
     "Source",
     "Destination",
-    "Status"
+    "Status",
+    "Size",
+    "Done",
+    "Speed",
+    "Elapsed",
+    "Priority"
 };
 
 TaskTableModel::TaskTableModel(QObject *parent)
@@ -42,6 +53,10 @@ TaskTableModel::TaskTableModel(QObject *parent)
             Q_ASSERT(taskIndex.isValid());
             emitDataChanged(taskIndex.row());
         });
+        connect(task, &Task::priorityChanged, [this, taskIndex] () {
+            Q_ASSERT(taskIndex.isValid());
+            emitDataChanged(taskIndex.row());
+        });
     });
 }
 
@@ -64,11 +79,11 @@ QVariant TaskTableModel::data(const QModelIndex &index, int role) const
             case Qt::DisplayRole:
             {
                 switch (index.column()) {
-                    case 0:
+                    case SourceColumn:
                         return task->inputFile();
-                    case 1:
+                    case DestinationColumn:
                         return ((Task::State::Succeded == task->state()) ? task->outputFile() : QString());
-                    case 2:
+                    case StatusColumn:
                     {
                         switch (task->state()) {
                             case Task::State::New:
@@ -78,17 +93,41 @@ QVariant TaskTableModel::data(const QModelIndex &index, int role) const
                             case Task::State::Running:
                                 return ((Qt::DisplayRole == role) ? QString() : QString("%1%").arg(task->progress()));
                             case Task::State::Succeded:
-                                return "Succeded";
+                                return (task->lastError().isEmpty() ? QString("Succeded") : QString("Succeded (%1)").arg(task->lastError()));
                             case Task::State::Failed:
                                 return QString("Failed (%1)").arg(task->lastError());
+                            case Task::State::Paused:
+                                return QString("Paused (%1%)").arg(task->progress());
                             default:
                                 break;
                         }
+                        break;
                     }
+                    case SizeColumn:
+                        return formatSize(task->size());
+                    case DoneColumn:
+                        return ((task->elapsed() > 0) ? formatSize(task->bytesDone()) : QString());
+                    case SpeedColumn:
+                        return ((task->elapsed() > 0) ? QString("%1 MB/s").arg(task->speed() / (1024 * 1024), 0, 'f', 1) : QString());
+                    case ElapsedColumn:
+                        return ((task->elapsed() > 0) ? formatElapsed(task->elapsed()) : QString());
+                    case PriorityColumn:
+                        return task->priority();
                     default:
                         break;
                 }
+                break;
             }
+            case Qt::TextAlignmentRole:
+                if (index.column() >= SizeColumn)
+                    return static_cast<int>(Qt::AlignRight | Qt::AlignVCenter);
+                break;
+            case ValueRole:
+                return value(*task, index.column());
+            case ProgressRole:
+                if (Task::State::Running == task->state())
+                    return task->progress();
+                break;
             default:
                 break;
         }
@@ -131,18 +170,80 @@ int TaskTableModel::rowCount(const QModelIndex &parent) const
     return (parent.isValid() ? 0 : _tasksCount);
 }
 
+double TaskTableModel::value(const Task &task, const int column)
+{
+    switch (column) {
+        case StatusColumn:
+            return static_cast<int>(task.state()) * 101 + task.progress();
+        case SizeColumn:
+            return task.size();
+        case DoneColumn:
+            return task.bytesDone();
+        case SpeedColumn:
+            return task.speed();
+        case ElapsedColumn:
+            return task.elapsed();
+        case PriorityColumn:
+            return task.priority();
+        default:
+            return 0.0;
+    }
+}
+
+QString TaskTableModel::formatSize(const qint64 size)
+{
+    static const QStringList units = { "B", "KB", "MB", "GB", "TB" };
+
+    auto unit = 0;
+    auto value = static_cast<double>(size);
+    while ((value >= 1024) && (unit < units.size() - 1)) {
+        value /= 1024;
+        ++unit;
+    }
+
+    return QString("%1 %2").arg(value, 0, 'f', (0 == unit) ? 0 : 1).arg(units.at(unit));
+}
+
+QString TaskTableModel::formatElapsed(const qint64 elapsed)
+{
+    const auto seconds = elapsed / 1000;
+
+    return QString("%1:%2:%3").arg(seconds / 3600).arg(seconds / 60 % 60, 2, 10, QChar('0')).arg(seconds % 60, 2, 10, QChar('0'));
+}
+
 void TaskTableModel::emitDataChanged(const int row)
 {
     Q_ASSERT((row >= 0) && (row < _tasksCount));
 
-    Q_EMIT dataChanged(index(row, 0), index(row, _headerData.size() - 1), QVector<int>() << Qt::DisplayRole << Qt::ToolTipRole);
+    Q_EMIT dataChanged(index(row, 0), index(row, _headerData.size() - 1), QVector<int>() << Qt::DisplayRole << Qt::ToolTipRole << ProgressRole << ValueRole);
 }
 
 // TaskFilterProxyModel
 
 TaskFilterProxyModel::TaskFilterProxyModel(QObject *parent)
     : QSortFilterProxyModel(parent)
-{}
+    , _matcher(QString(), Qt::CaseInsensitive)
+    , _filterTimer(new QTimer(this))
+    , _matching(false)
+    , _matchingRevision(0)
+    , _sourceRevision(0)
+{
+    std::fill(std::begin(_stateMatches), std::end(_stateMatches), true);
+
+    _filterTimer->setSingleShot(true);
+    _filterTimer->setInterval(150);
+    connect(_filterTimer, &QTimer::timeout, this, &TaskFilterProxyModel::startMatching);
+    connect(&_matchingWatcher, &QFutureWatcher<QVector<quint8>>::finished, this, &TaskFilterProxyModel::applyMatches);
+}
+
+void TaskFilterProxyModel::setFilterText(const QString &filterText)
+{
+    _pendingFilterText = filterText;
+    if (filterText.isEmpty())
+        startMatching();
+    else
+        _filterTimer->start();
+}
 
 bool TaskFilterProxyModel::removeRows(int row, int count, const QModelIndex &parent)
 {
@@ -161,16 +262,325 @@ bool TaskFilterProxyModel::removeRows(int row, int count, const QModelIndex &par
     return true;
 }
 
+void TaskFilterProxyModel::setSourceModel(QAbstractItemModel *sourceModel)
+{
+    if (Q_NULLPTR != this->sourceModel())
+        disconnect(this->sourceModel(), Q_NULLPTR, this, Q_NULLPTR);
+
+    ++_sourceRevision;
+    _paths.clear();
+    _trigrams.clear();
+    _matches.clear();
+
+    if (Q_NULLPTR != sourceModel) {
+        // Connected before the base class, so the index is up to date by the time the new rows are filtered
+        connect(sourceModel, &QAbstractItemModel::rowsInserted, this, [this] (const QModelIndex &parent, int first, int last) {
+            if (!parent.isValid())
+                insertSourceRows(first, last);
+        });
+        connect(sourceModel, &QAbstractItemModel::rowsRemoved, this, [this] (const QModelIndex &parent, int first, int last) {
+            if (!parent.isValid())
+                removeSourceRows(first, last);
+        });
+
+        insertSourceRows(0, sourceModel->rowCount() - 1);
+    }
+
+    QSortFilterProxyModel::setSourceModel(sourceModel);
+}
+
 bool TaskFilterProxyModel::filterAcceptsRow(int sourceRow, const QModelIndex &sourceParent) const
 {
-    auto model = sourceModel();
-    if (Q_NULLPTR != model) {
-        const auto regExp = filterRegExp();
-        for (auto i = 0; i < sourceModel()->columnCount(); ++i) {
-            if (model->data(sourceModel()->index(sourceRow, i, sourceParent)).toString().contains(regExp))
-                return true;
+    if (_filterText.isEmpty() || sourceParent.isValid())
+        return true;
+
+    const auto task = TaskManager::instance()->tasks().value(sourceRow);
+    Q_ASSERT(Q_NULLPTR != task);
+    for (const auto &i : _conditions) {
+        if (!i.accepts(*task))
+            return false;
+    }
+
+    return _matchText.isEmpty() || ((sourceRow < _matches.size()) && _matches.at(sourceRow)) || matchesState(sourceRow);
+}
+
+bool TaskFilterProxyModel::lessThan(const QModelIndex &sourceLeft, const QModelIndex &sourceRight) const
+{
+    // Compares the tasks themselves, neither formatted strings nor variants are built
+    const auto &tasks = TaskManager::instance()->tasks();
+    const auto left = tasks.value(sourceLeft.row());
+    const auto right = tasks.value(sourceRight.row());
+    Q_ASSERT((Q_NULLPTR != left) && (Q_NULLPTR != right));
+
+    switch (sourceLeft.column()) {
+        case TaskTableModel::SourceColumn:
+            return (QString::compare(left->inputFile(), right->inputFile(), Qt::CaseInsensitive) < 0);
+        case TaskTableModel::DestinationColumn:
+            return (QString::compare(left->outputFile(), right->outputFile(), Qt::CaseInsensitive) < 0);
+        default:
+            return (TaskTableModel::value(*left, sourceLeft.column()) < TaskTableModel::value(*right, sourceLeft.column()));
+    }
+}
+
+bool TaskFilterProxyModel::Condition::accepts(const Task &task) const
+{
+    const auto actual = (TaskTableModel::StatusColumn == column) ? static_cast<int>(task.state()) : TaskTableModel::value(task, column);
+    switch (operation) {
+        case '<':
+            return (actual < value);
+        case '>':
+            return (actual > value);
+        default:
+            return (actual == value);
+    }
+}
+
+void TaskFilterProxyModel::parseFilter(const QString &filterText, QString &text, QVector<Condition> &conditions)
+{
+    static const QRegularExpression pattern("^(state|size|done|speed|elapsed)([<>=:])(.+)$", QRegularExpression::CaseInsensitiveOption);
+    static const QStringList states = { "new", "queued", "running", "succeeded", "failed", "paused" };
+    static const QString sizeUnits = "kmgt";
+    static const QString timeUnits = "smh";
+    static const double timeMultipliers[] = { 1000.0, 60 * 1000.0, 60 * 60 * 1000.0 };
+
+    QStringList words;
+    for (const auto &word : filterText.split(' ', QString::SkipEmptyParts)) {
+        const auto match = pattern.match(word);
+        if (!match.hasMatch()) {
+            words << word;
+            continue;
         }
+
+        const auto key = match.captured(1).toLower();
+        auto valueText = match.captured(3).toLower();
+
+        Condition condition;
+        condition.operation = (":" == match.captured(2)) ? '=' : match.captured(2).at(0).toLatin1();
+
+        auto ok = false;
+        if ("state" == key) {
+            condition.column = TaskTableModel::StatusColumn;
+            // The status column spells it "Succeded"
+            const auto state = states.indexOf(("succeded" == valueText) ? QString("succeeded") : valueText);
+            condition.value = state;
+            ok = (state >= 0);
+        } else {
+            auto multiplier = 1.0;
+            if (("size" == key) || ("done" == key)) {
+                condition.column = ("size" == key) ? TaskTableModel::SizeColumn : TaskTableModel::DoneColumn;
+                if (valueText.endsWith('b'))
+                    valueText.chop(1);
+                const auto unit = sizeUnits.indexOf(valueText.right(1));
+                if (unit >= 0) {
+                    multiplier = std::pow(1024.0, unit + 1);
+                    valueText.chop(1);
+                }
+            } else if ("speed" == key) {
+                condition.column = TaskTableModel::SpeedColumn;
+                multiplier = 1024 * 1024;
+            } else {
+                condition.column = TaskTableModel::ElapsedColumn;
+                const auto unit = timeUnits.indexOf(valueText.right(1));
+                multiplier = timeMultipliers[qMax(0, unit)];
+                if (unit >= 0)
+                    valueText.chop(1);
+            }
+            condition.value = valueText.toDouble(&ok) * multiplier;
+        }
+
+        if (ok)
+            conditions << condition;
+        else
+            words << word;
     }
 
-    return QSortFilterProxyModel::filterAcceptsRow(sourceRow, sourceParent);
+    text = words.join(' ');
+}
+
+TaskFilterProxyModel::Trigrams TaskFilterProxyModel::trigrams(const QString &text)
+{
+    Trigrams result;
+    const auto folded = text.toCaseFolded();
+    for (auto i = 2; i < folded.size(); ++i) {
+        const quint32 hash = (folded.at(i - 2).unicode() * 961u + folded.at(i - 1).unicode() * 31u + folded.at(i).unicode()) * 2654435761u;
+        const auto bit = hash >> 25;
+        if (bit < 64)
+            result.low |= quint64(1) << bit;
+        else
+            result.high |= quint64(1) << (bit - 64);
+    }
+
+    return result;
+}
+
+void TaskFilterProxyModel::matchRows(const QString *paths, const Trigrams *trigrams, quint8 *matches, const int count, const QString &text, const bool narrow)
+{
+    if (text.isEmpty()) {
+        std::fill(matches, matches + count, 1);
+
+        return;
+    }
+
+    const QStringMatcher matcher(text, Qt::CaseInsensitive);
+    const auto textTrigrams = TaskFilterProxyModel::trigrams(text);
+    static const int batchSize = 16384;
+    auto matchBatch = [&] (const int begin) {
+        const auto end = qMin(begin + batchSize, count);
+        for (auto i = begin; i < end; ++i) {
+            if (!narrow || matches[i])
+                matches[i] = trigrams[i].contains(textTrigrams) && (-1 != matcher.indexIn(paths[i]));
+        }
+    };
+
+    if (count <= batchSize) {
+        matchBatch(0);
+
+        return;
+    }
+
+    QVector<int> batches;
+    for (auto i = 0; i < count; i += batchSize)
+        batches << i;
+
+    QtConcurrent::blockingMap(batches, matchBatch);
+}
+
+void TaskFilterProxyModel::insertSourceRows(int first, int last)
+{
+    if (last < first)
+        return;
+
+    if (_matching)
+        _rowChanges.append({ true, first, last - first + 1 });
+
+    const auto tasks = TaskManager::instance()->tasks();
+    const auto count = last - first + 1;
+    _paths.insert(first, count, QString());
+    _trigrams.insert(first, count, Trigrams());
+    _matches.insert(first, count, 0);
+    for (auto i = first; i <= last; ++i) {
+        _paths[i] = tasks.at(i)->inputFile();
+        _trigrams[i] = trigrams(_paths.at(i));
+    }
+
+    matchRows(_paths.constData() + first, _trigrams.constData() + first, _matches.data() + first, count, _matchText, false);
+}
+
+void TaskFilterProxyModel::removeSourceRows(int first, int last)
+{
+    if (_matching)
+        _rowChanges.append({ false, first, last - first + 1 });
+
+    _paths.remove(first, last - first + 1);
+    _trigrams.remove(first, last - first + 1);
+    _matches.remove(first, last - first + 1);
+}
+
+void TaskFilterProxyModel::startMatching()
+{
+    _filterTimer->stop();
+
+    // Only one search runs at a time, the latest text is picked up when it is done
+    if (_matching || (_pendingFilterText == _filterText))
+        return;
+
+    QString text;
+    QVector<Condition> conditions;
+    parseFilter(_pendingFilterText, text, conditions);
+
+    _matchingFilterText = _pendingFilterText;
+    _matchingText = text;
+    _matchingConditions = conditions;
+    _matchingRevision = _sourceRevision;
+
+    // Only the conditions have changed, they are cheap enough to check while filtering
+    if (text == _matchText) {
+        applyFilter(_matches);
+
+        return;
+    }
+
+    // Typing more characters can only narrow the matches down, so only the rows that still match are checked again
+    const auto narrow = !_matchText.isEmpty() && text.contains(_matchText, Qt::CaseInsensitive);
+
+    // The containers are implicitly shared, so the snapshot is free until the rows change
+    const auto paths = _paths;
+    const auto trigrams = _trigrams;
+    auto matches = _matches;
+    _matching = true;
+    _matchingWatcher.setFuture(QtConcurrent::run([paths, trigrams, matches, text, narrow] () mutable {
+        matchRows(paths.constData(), trigrams.constData(), matches.data(), matches.size(), text, narrow);
+
+        return matches;
+    }));
+}
+
+void TaskFilterProxyModel::applyMatches()
+{
+    static const quint8 unmatched = 2;
+
+    if (_matchingRevision == _sourceRevision) {
+        auto matches = _matchingWatcher.result();
+
+        // New tasks keep arriving in continuous mode, so the rows that changed meanwhile are merged into the
+        // result rather than starting over; the inserted ones are matched against the new text here
+        for (const auto &i : _rowChanges) {
+            if (i.inserted)
+                matches.insert(i.first, i.count, unmatched);
+            else
+                matches.remove(i.first, i.count);
+        }
+
+        Q_ASSERT(matches.size() == _paths.size());
+        for (auto i = 0; i < matches.size(); ) {
+            auto end = i;
+            while ((end < matches.size()) && (unmatched == matches.at(end)))
+                ++end;
+
+            if (end > i)
+                matchRows(_paths.constData() + i, _trigrams.constData() + i, matches.data() + i, end - i, _matchingText, false);
+
+            i = end + 1;
+        }
+
+        applyFilter(matches);
+    }
+
+    _matching = false;
+    _rowChanges.clear();
+    startMatching();
+}
+
+void TaskFilterProxyModel::applyFilter(const QVector<quint8> &matches)
+{
+    static const QStringList stateNames = { "New", "Queued", QString(), "Succeded", "Failed", "Paused" };
+
+    beginResetModel();
+    _filterText = _matchingFilterText;
+    _matchText = _matchingText;
+    _conditions = _matchingConditions;
+    _matcher.setPattern(_matchText);
+    for (auto i = 0; i < stateNames.size(); ++i)
+        _stateMatches[i] = stateNames.at(i).contains(_matchText, Qt::CaseInsensitive);
+    _matches = matches;
+    endResetModel();
+}
+
+bool TaskFilterProxyModel::matchesState(const int sourceRow) const
+{
+    const QPointer<Task> task(TaskManager::instance()->tasks().value(sourceRow));
+    Q_ASSERT(task);
+
+    const auto state = task->state();
+    if (_stateMatches[static_cast<int>(state)])
+        return true;
+
+    switch (state) {
+        case Task::State::Succeded:
+            return (-1 != _matcher.indexIn(task->outputFile())) || (-1 != _matcher.indexIn(task->lastError()));
+        case Task::State::Failed:
+            return (-1 != _matcher.indexIn(task->lastError()));
+        default:
+            return false;
+    }
 }
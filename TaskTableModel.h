@@ -2,7 +2,12 @@
 #define TASKTABLEMODEL_H
 
 #include <QAbstractTableModel>
+#include <QFutureWatcher>
 #include <QSortFilterProxyModel>
+#include <QStringMatcher>
+#include <QVector>
+
+class Task;
 
 // TaskTableModel
 class TaskTableModel : public QAbstractTableModel
@@ -10,6 +15,23 @@ class TaskTableModel : public QAbstractTableModel
     Q_OBJECT
 
 public:
+    enum Column {
+        SourceColumn,
+        DestinationColumn,
+        StatusColumn,
+        SizeColumn,
+        DoneColumn,
+        SpeedColumn,
+        ElapsedColumn,
+        PriorityColumn
+    };
+
+    enum Role {
+        ProgressRole = Qt::UserRole,
+        // The unformatted number behind a column, see value()
+        ValueRole
+    };
+
     explicit TaskTableModel(QObject *parent = Q_NULLPTR);
 
     int columnCount(const QModelIndex &parent = QModelIndex()) const Q_DECL_OVERRIDE;
@@ -19,7 +41,13 @@ public:
     bool removeRows(int row, int count, const QModelIndex &parent) Q_DECL_OVERRIDE;
     int rowCount(const QModelIndex &parent) const Q_DECL_OVERRIDE;
 
+    // Sizes are in bytes, speed in bytes per second, elapsed time in milliseconds, the status orders by state and then by progress
+    static double value(const Task &task, const int column);
+
 private:
+    static QString formatSize(const qint64 size);
+    static QString formatElapsed(const qint64 elapsed);
+
     void emitDataChanged(const int row);
 
     static const QVariantList _headerData;
@@ -28,6 +56,8 @@ private:
 };
 
 // TaskFilterProxyModel
+class QTimer;
+
 class TaskFilterProxyModel : public QSortFilterProxyModel
 {
     Q_OBJECT
@@ -35,10 +65,80 @@ class TaskFilterProxyModel : public QSortFilterProxyModel
 public:
     explicit TaskFilterProxyModel(QObject *parent = Q_NULLPTR);
 
+    const QString& filterText() const { return _filterText; }
+    // Debounced, the rows are matched on a background thread and the result is applied at once.
+    // Words like state:failed, size>100M, done<1G, speed<10 (MB/s) or elapsed>5m compare the numbers of a column
+    void setFilterText(const QString &filterText);
+
     bool removeRows(int row, int count, const QModelIndex &parent) Q_DECL_OVERRIDE;
+    void setSourceModel(QAbstractItemModel *sourceModel) Q_DECL_OVERRIDE;
 
 protected:
     bool filterAcceptsRow(int sourceRow, const QModelIndex &sourceParent) const Q_DECL_OVERRIDE;
+    bool lessThan(const QModelIndex &sourceLeft, const QModelIndex &sourceRight) const Q_DECL_OVERRIDE;
+
+private:
+    struct Condition {
+        bool accepts(const Task &task) const;
+
+        int column;
+        char operation;
+        double value;
+    };
+
+    static void parseFilter(const QString &filterText, QString &text, QVector<Condition> &conditions);
+
+    // A 128-bit set of hashed case-folded trigrams, a row can only contain the filter if it has all of its trigrams
+    struct Trigrams {
+        Trigrams() : low(0), high(0) {}
+
+        bool contains(const Trigrams &other) const { return ((low & other.low) == other.low) && ((high & other.high) == other.high); }
+
+        quint64 low;
+        quint64 high;
+    };
+
+    // Rows inserted or removed while a match runs in the background, they are carried over into its result
+    struct RowChange {
+        bool inserted;
+        int first;
+        int count;
+    };
+
+    static Trigrams trigrams(const QString &text);
+    static void matchRows(const QString *paths, const Trigrams *trigrams, quint8 *matches, const int count, const QString &text, const bool narrow);
+
+    void insertSourceRows(int first, int last);
+    void removeSourceRows(int first, int last);
+    void startMatching();
+    void applyMatches();
+    void applyFilter(const QVector<quint8> &matches);
+    bool matchesState(const int sourceRow) const;
+
+    // The filter in effect, and the one that was asked for last
+    QString _filterText;
+    QString _pendingFilterText;
+    // The words of the filter in effect, the matches belong to them
+    QString _matchText;
+    QVector<Condition> _conditions;
+    QStringMatcher _matcher;
+    bool _stateMatches[6];
+    // All of them are kept in step with the source rows; the input file is the only column that never changes
+    QVector<QString> _paths;
+    QVector<Trigrams> _trigrams;
+    QVector<quint8> _matches;
+
+    QTimer *_filterTimer;
+    QFutureWatcher<QVector<quint8>> _matchingWatcher;
+    // From the start of a background match until its result has been applied
+    bool _matching;
+    QString _matchingFilterText;
+    QString _matchingText;
+    QVector<Condition> _matchingConditions;
+    QVector<RowChange> _rowChanges;
+    // Bumped when the source model is replaced, a result for the previous one is dropped
+    quint64 _matchingRevision;
+    quint64 _sourceRevision;
 };
 
 #endif // TASKTABLEMODEL_H
@@ -1,162 +1,1171 @@
 #include "ThreadPool.h"
 
+#include <QBuffer>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
 #include <QFileInfo>
 #include <QPointer>
+#include <QSemaphore>
+#include <QSharedPointer>
+#include <QThread>
 #include <QThreadPool>
 
+#include <numeric>
+
+#include "BufferPool.h"
+#include "Chunker.h"
+#include "ChunkStore.h"
 #include "Crypto.h"
+#include "FileHeader.h"
+#include "FileNameAllocator.h"
+#include "InPlaceJournal.h"
+#include "IoBackend.h"
 #include "Settings.h"
+#include "Throttle.h"
 #include "Utils.h"
 
-using namespace Crypto;
+using namespace Crypto;
+
+// FunctionRunnable
+class FunctionRunnable : public QRunnable
+{
+public:
+    explicit FunctionRunnable(const std::function<void ()> &function)
+        : _function(function)
+    {}
+
+    void run() Q_DECL_OVERRIDE { _function(); }
+
+private:
+    const std::function<void ()> _function;
+};
+
+// Archives and the chunk store are unlocked with the current password first, then with the keyring
+static QVector<QByteArray> decryptionKeys()
+{
+    QVector<QByteArray> keys;
+    for (const auto &i : Settings::instance().decryptionKeys())
+        keys << i.key;
+
+    return keys;
+}
+
+// TaskJob
+
+const QString TaskJob::encryptedFileExt = ".haralug";
+const QString TaskJob::journalFileExt   = ".haralug-journal";
+const QString TaskJob::archiveFileExt   = ".haralug-archive";
+const QString TaskJob::chunkListFileExt = ".haralug-chunks";
+
+const QByteArray TaskJob::inPlaceMagic = "HRLGINPL";
+
+const qint64 TaskJob::cacheRegionSize = 8 * 1024 * 1024;
+
+TaskJob::TaskJob(TaskPtr task, QObject *parent)
+    : QObject(parent)
+    , QRunnable()
+    , _task(task)
+    , _queued(false)
+    , _held(false)
+    , _parkedThreads(0)
+    , _running(false)
+    , _pauseRequested(false)
+{
+    setAutoDelete(false);
+}
+
+void TaskJob::run()
+{
+    _interruptionRequested = false;
+    _running = true;
+
+    applyWorkerSettings();
+
+    doJob();
+
+    _running = false;
+    _finished.wakeAll();
+
+    ThreadPool::instance()->jobDone();
+
+    Q_EMIT finished();
+}
+
+void TaskJob::applyWorkerSettings()
+{
+    // Worker threads are reused, so the current setting is applied to every job
+    Utils::setThreadPriority(Settings::instance().niceness(), Settings::instance().ioPriority());
+    // Buffers are taken from the pool's free list of the node the thread runs on
+    Utils::setThreadAffinity(Settings::instance().pinWorkers() ? ThreadPool::instance()->workerCpus(_task->inputFile()) : QVector<int>());
+}
+
+void TaskJob::forEachParallel(const int count, const std::function<void (int)> &function)
+{
+    std::atomic_int next(0);
+    auto work = [&next, count, &function] () {
+        for (auto i = next++; i < count; i = next++)
+            function(i);
+    };
+
+    // Helpers only take threads the pool has free right now, so the worker limit holds
+    // and a job never waits for a helper that is still queued
+    QSemaphore helpersDone;
+    auto helpers = 0;
+    while (helpers < count - 1) {
+        auto helper = new FunctionRunnable([this, &work, &helpersDone] () {
+            applyWorkerSettings();
+            work();
+            helpersDone.release();
+        });
+
+        if (!ThreadPool::instance()->_threadPool->tryStart(helper)) {
+            delete helper;
+            break;
+        }
+
+        ++helpers;
+    }
+
+    work();
+    helpersDone.acquire(helpers);
+}
+
+void TaskJob::doJob() noexcept
+{
+    Q_ASSERT(Q_NULLPTR != _task);
+    setTaskLastError(QString());
+    setTaskState(Task::State::Running);
+
+    const auto inputFileName = _task->inputFile();
+
+    if (QFileInfo(inputFileName).isDir()) {
+        doPackJob();
+
+        return;
+    }
+
+    if (inputFileName.endsWith(archiveFileExt)) {
+        doUnpackJob();
+
+        return;
+    }
+
+    if (inputFileName.endsWith(chunkListFileExt)) {
+        doRestoreJob();
+
+        return;
+    }
+
+    // A file with a trailer but without the extension was encrypted in place and only missed its rename,
+    // it must be finished in place whatever the settings are now, or it would be encrypted twice
+    auto inPlace = QFile::exists(inputFileName + journalFileExt);
+    if (!inPlace) {
+        QFile inputFile(inputFileName);
+        QByteArray trailer;
+        FileHeader header;
+        const auto hasTrailer = inputFile.open(QFile::ReadOnly) && readInPlaceTrailer(inputFile, trailer, header);
+        // Files in the legacy CBC format can't be transformed in place, they are always copied
+        inPlace = (hasTrailer && !inputFileName.endsWith(encryptedFileExt))
+            || (Settings::instance().inPlace() && (!inputFileName.endsWith(encryptedFileExt) || hasTrailer));
+    }
+
+    if (!inPlace && Settings::instance().deduplicate() && !inputFileName.endsWith(encryptedFileExt)) {
+        doDedupJob();
+
+        return;
+    }
+
+    if (inPlace)
+        doInPlaceJob();
+    else
+        doCopyJob();
+}
+
+void TaskJob::doCopyJob()
+{
+    auto encrypt = true;
+    auto outputFileName = _task->inputFile();
+
+    if (outputFileName.endsWith(encryptedFileExt)) {
+        encrypt = false;
+        outputFileName = outputFileName.left(outputFileName.length() - encryptedFileExt.length());
+    } else {
+        outputFileName += encryptedFileExt;
+    }
+
+    const auto incremental = encrypt && Settings::instance().incremental();
+    Manifest::Entry state;
+    QString previousOutputFileName;
+    if (incremental && skipUnchanged(encryptedFileExt, state, previousOutputFileName))
+        return;
+
+    QFile inputFile(_task->inputFile());
+    if (!inputFile.open(QFile::ReadOnly)) {
+        setTaskFailed(QString("'%1': %2").arg(inputFile.fileName()).arg(inputFile.errorString()));
+
+        return;
+    }
+
+    auto key = Settings::instance().key();
+    Q_ASSERT(!key.isEmpty());
+
+    auto inputSize = inputFile.size();
+    CipherLease cipher;
+    QByteArray headerData;
+
+    try {
+        if (encrypt) {
+            FileHeader header;
+            header.algorithm = Factory::preferredAlgorithm();
+            header.iv        = Factory::randomBytes(Factory::algorithmInfo(header.algorithm)->ivSize);
+            header.setKeyCheck(key);
+
+            // The data is encrypted with a key of its own, the password only wraps that key
+            const auto dataKey = Factory::randomBytes(key.size());
+            header.wrapKey(key, dataKey);
+
+            headerData = header.toByteArray();
+            cipher = Factory::instance().acquireCipher(dataKey, header.algorithm, header.iv, true);
+            cipher->setAad(header.aad());
+        } else if (FileHeader::hasMagic(inputFile)) {
+            FileHeader header;
+            if (!header.read(inputFile)) {
+                setTaskFailed("Unsupported file format");
+
+                return;
+            }
+
+            if (!selectKey([&header] (const Settings::Keys &keys) { return header.checkKey(keys.key); }, key)) {
+                setTaskFailed("Wrong password");
+
+                return;
+            }
+
+            const auto info = Factory::algorithmInfo(header.algorithm);
+            if (Q_NULLPTR == info) {
+                setTaskFailed("Unsupported cipher");
+
+                return;
+            }
+
+            const auto headerSize = inputFile.pos();
+            if (inputSize - headerSize < info->tagSize) {
+                setTaskFailed("The file is truncated");
+
+                return;
+            }
+
+            const auto dataKey = header.unwrapKey(key);
+            cipher = Factory::instance().acquireCipher(dataKey, header.algorithm, header.iv, false);
+            if (cipher->isAuthenticated()) {
+                inputSize -= info->tagSize;
+                inputFile.seek(inputSize);
+                cipher->setTag(inputFile.read(info->tagSize));
+                cipher->setAad(header.aad());
+                inputFile.seek(headerSize);
+            }
+        } else {
+            QByteArray trailer;
+            FileHeader header;
+            if (readInPlaceTrailer(inputFile, trailer, header)) {
+                if (!selectKey([&header] (const Settings::Keys &keys) { return header.checkKey(keys.key); }, key)) {
+                    setTaskFailed("Wrong password");
+
+                    return;
+                }
+
+                inputSize -= trailer.size();
+                inputFile.seek(0);
+                cipher = Factory::instance().acquireStreamCipher(header.unwrapKey(key), header.iv);
+            } else {
+                // Legacy files: the signature followed by AES-256-CBC with a zero IV
+                const auto prefix = inputFile.seek(0) ? inputFile.read(Settings::instance().signature().size()) : QByteArray();
+                if (!selectKey([&prefix] (const Settings::Keys &keys) { return keys.signature == prefix; }, key)) {
+                    setTaskFailed("Wrong password");
+
+                    return;
+                }
+
+                cipher = Factory::instance().acquireCipher(key, Algorithm::Aes256Cbc, QByteArray(Factory::algorithmInfo(Algorithm::Aes256Cbc)->ivSize, 0), false);
+            }
+        }
+    } catch (const Exception &e) {
+        setTaskFailed(e.errorMessage());
+
+        return;
+    }
+
+    Q_ASSERT(cipher);
+
+    // Waits while the buffer memory limit is reached, before anything is created on the disk;
+    // nothing else is allocated per chunk
+    const auto buffer = BufferPool::instance().acquire(_interruptionRequested);
+    if (!buffer) {
+        setTaskFailed("Aborted");
+
+        return;
+    }
+
+    QString errorString;
+    const auto reservedFileName = FileNameAllocator::instance().reserve(outputFileName, encrypt, errorString);
+    if (reservedFileName.isEmpty()) {
+        setTaskFailed(QString("'%1': %2").arg(outputFileName).arg(errorString));
+
+        return;
+    }
+
+    outputFileName = reservedFileName;
+
+    QFile outputFile(outputFileName);
+    if (!outputFile.open(QFile::WriteOnly)) {
+        setTaskFailed(QString("'%1': %2").arg(outputFileName).arg(outputFile.errorString()));
+        outputFile.remove();
+        FileNameAllocator::instance().release(outputFileName);
+
+        return;
+    }
+
+    if (encrypt)
+        outputFile.write(headerData);
+
+    const auto bypassPageCache = Settings::instance().bypassPageCache();
+    auto inputCached = inputFile.pos(), outputCached = qint64(0), outputEvicted = qint64(0);
+
+    IoBackendPtr io(IoBackend::create(inputFile, inputSize, outputFile));
+    Q_ASSERT(io);
+
+    auto failJob = [&] (const QString &lastError) {
+        setTaskFailed(lastError);
+        io.clear();
+        outputFile.close();
+        outputFile.remove();
+        FileNameAllocator::instance().release(outputFileName);
+    };
+
+    try {
+        DigestPtr digest;
+        if (incremental)
+            digest = Factory::instance().createDigest(Factory::SHA::SHA256);
+
+        auto progress = 0;
+        const char *chunk = Q_NULLPTR;
+        auto chunkLength = 0;
+        while (io->inputPos() < inputSize) {
+            if (_interruptionRequested) {
+                failJob("Aborted");
+
+                return;
+            }
+
+            if (!io->read(buffer.input(), chunk, chunkLength)) {
+                failJob(io->errorString());
+
+                return;
+            }
+
+            checkpoint(chunkLength);
+            if (!io->write(buffer.output(), cipher->update(chunk, chunkLength, buffer.output()))) {
+                failJob(io->errorString());
+
+                return;
+            }
+
+            if (digest)
+                digest->update(chunk, chunkLength);
+
+            const auto newProgress = 100 * io->inputPos() / inputSize;
+            if (newProgress > progress)
+                setTaskProgress(progress = newProgress);
+
+            if (bypassPageCache && (io->inputPos() - inputCached >= cacheRegionSize)) {
+                // Asynchronous writes have to reach the page cache before it can be trimmed
+                if (!io->flush()) {
+                    failJob(io->errorString());
+
+                    return;
+                }
+
+                Utils::dropReadCache(inputFile, inputCached, io->inputPos() - inputCached);
+                inputCached = io->inputPos();
+                Utils::dropWriteCache(outputFile, outputEvicted, outputCached, io->outputPos() - outputCached);
+                outputEvicted = outputCached;
+                outputCached = io->outputPos();
+            }
+        }
+
+        if (!io->write(cipher->updateFinal()) || (encrypt && cipher->isAuthenticated() && !io->write(cipher->tag())) || !io->flush()) {
+            failJob(io->errorString());
+
+            return;
+        }
+
+        // The output has to be on the disk before it replaces anything or the original is wiped
+        if (!Utils::syncFile(outputFile)) {
+            failJob(QString("'%1': %2").arg(outputFileName).arg(outputFile.errorString()));
+
+            return;
+        }
+
+        if (bypassPageCache) {
+            Utils::dropReadCache(inputFile, inputCached, io->inputPos() - inputCached);
+            Utils::dropWriteCache(outputFile, outputEvicted, outputCached, io->outputPos() - outputCached);
+            Utils::dropWriteCache(outputFile, outputCached, io->outputPos(), 0);
+        }
+
+        io.clear();
+
+        if (incremental) {
+            outputFile.close();
+            outputFileName = replacePreviousOutput(outputFileName, previousOutputFileName);
+            state.hash = digest->updateFinal();
+            state.outputFile = outputFileName;
+            Manifest::instance().update(inputFile.fileName(), state);
+        }
+
+        setTaskOutputFile(outputFileName);
+    } catch (const Exception &e) {
+        failJob(e.errorMessage());
+
+        return;
+    }
+
+    if (encrypt && Settings::instance().secureDelete()) {
+        inputFile.close();
+        if (!Utils::secureRemove(inputFile.fileName(), errorString)) {
+            setTaskFailed(QString("'%1': %2").arg(inputFile.fileName()).arg(errorString));
+
+            return;
+        }
+    }
+
+    setTaskState(Task::State::Succeded);
+}
+
+void TaskJob::doInPlaceJob()
+{
+    const auto inputFileName   = _task->inputFile();
+    const auto journalFileName = inputFileName + journalFileExt;
+
+    auto key = Settings::instance().key();
+    Q_ASSERT(!key.isEmpty());
+
+    QFile file(inputFileName);
+    if (!file.open(QFile::ReadWrite)) {
+        setTaskFailed(QString("'%1': %2").arg(file.fileName()).arg(file.errorString()));
+
+        return;
+    }
+
+    QString errorString;
+    FileHeader header;
+    QByteArray dataKey;
+    InPlaceJournal journal;
+
+    try {
+        auto recovering = journal.load(journalFileName) && parseInPlaceTrailer(journal.trailer, header) && (header.iv == journal.iv);
+        if (recovering) {
+            if (!selectKey([&header] (const Settings::Keys &keys) { return header.checkKey(keys.key); }, key)) {
+                setTaskFailed("Wrong password");
+
+                return;
+            }
+
+            dataKey = header.unwrapKey(key);
+
+            // The logged chunks may be torn: every byte must be either original or transformed,
+            // otherwise the journal belongs to some other file that used to have the same name
+            auto isConsistent = [&file] (const qint64 offset, const QByteArray &original, const QByteArray &transformed) {
+                const auto current = file.seek(offset) ? file.read(original.size()) : QByteArray();
+                if (current.size() != original.size())
+                    return false;
+
+                for (auto i = 0; i < original.size(); ++i) {
+                    if ((current.at(i) != original.at(i)) && (current.at(i) != transformed.at(i)))
+                        return false;
+                }
+
+                return true;
+            };
+
+            if (journal.offset < journal.payloadSize) {
+                // Only the last two logged chunks can be incomplete: a chunk is synced with the slot after its own,
+                // so both slots are replayed in order, everything in front of them is already durable
+                const auto logged = journal.readSlots(file, journal.payloadSize + journal.trailer.size());
+                for (const auto &i : logged) {
+                    const auto decrypted = Factory::instance().acquireStreamCipher(dataKey, journal.iv, i.chunkOffset)->update(i.encryptedChunk);
+                    const auto &transformed = journal.encrypt ? i.encryptedChunk : decrypted;
+                    recovering = isConsistent(i.chunkOffset, journal.encrypt ? decrypted : i.encryptedChunk, transformed);
+                    if (!recovering)
+                        break;
+
+                    if (!file.seek(i.chunkOffset) || (file.write(transformed) != transformed.size())) {
+                        setTaskFailed(QString("'%1': %2").arg(file.fileName()).arg(file.errorString()));
+
+                        return;
+                    }
+
+                    journal.offset = i.chunkOffset + transformed.size();
+                }
+
+                // The next slot overwrites the older one, so the replayed chunks have to be durable first
+                if (recovering && !logged.isEmpty() && !Utils::syncFile(file)) {
+                    setTaskFailed(QString("'%1': %2").arg(file.fileName()).arg(file.errorString()));
+
+                    return;
+                }
+            }
+
+            if (!recovering) {
+                QFile::remove(journalFileName);
+                journal = InPlaceJournal();
+            }
+        }
+
+        if (!recovering) {
+            QByteArray trailer;
+            if (readInPlaceTrailer(file, trailer, header)) {
+                if (!selectKey([&header] (const Settings::Keys &keys) { return header.checkKey(keys.key); }, key)) {
+                    setTaskFailed("Wrong password");
+
+                    return;
+                }
+
+                dataKey = header.unwrapKey(key);
+
+                journal.encrypt     = !inputFileName.endsWith(encryptedFileExt);
+                journal.trailer     = trailer;
+                journal.iv          = header.iv;
+                journal.payloadSize = file.size() - trailer.size();
+                // An encrypted file without a journal has only missed its final rename
+                journal.offset      = journal.encrypt ? journal.payloadSize : 0;
+            } else if (!Settings::instance().inPlace() || inputFileName.endsWith(encryptedFileExt)) {
+                file.close();
+                doCopyJob();
+
+                return;
+            } else {
+                // The stream is encrypted with a key of its own, the password only wraps that key
+                header = FileHeader();
+                header.algorithm = Algorithm::Aes256Ctr;
+                header.iv        = Factory::randomBytes(Factory::streamIvSize);
+                header.setKeyCheck(key);
+                dataKey = Factory::randomBytes(key.size());
+                header.wrapKey(key, dataKey);
+
+                journal.encrypt     = true;
+                journal.trailer     = inPlaceTrailer(header);
+                journal.iv          = header.iv;
+                journal.payloadSize = file.size();
+            }
+
+            if ((journal.offset < journal.payloadSize) && !journal.save(journalFileName, errorString)) {
+                setTaskFailed(QString("'%1': %2").arg(journalFileName).arg(errorString));
+
+                return;
+            }
+        }
+
+        auto cipher = Factory::instance().acquireStreamCipher(dataKey, journal.iv, journal.offset);
+        Q_ASSERT(cipher);
+
+        // The slots follow the trailer of a file being decrypted, and the room for it when encrypting
+        const auto slotsOffset = journal.payloadSize + journal.trailer.size();
+
+        auto progress = 0;
+        while (journal.offset < journal.payloadSize) {
+            if (_interruptionRequested) {
+                setTaskFailed("Aborted, start the task again to resume");
+
+                return;
+            }
+
+            if (!file.seek(journal.offset)) {
+                setTaskFailed(QString("'%1': %2").arg(file.fileName()).arg(file.errorString()));
+
+                return;
+            }
+
+            const auto original = file.read(qMin(InPlaceJournal::chunkSize, journal.payloadSize - journal.offset));
+            if (original.isEmpty()) {
+                setTaskFailed(QString("'%1': %2").arg(file.fileName()).arg(file.errorString()));
+
+                return;
+            }
+
+            checkpoint(original.size());
+
+            const auto chunk = cipher->update(original);
+            Q_ASSERT(chunk.size() == original.size());
+
+            // Plaintext never reaches the slots, so nothing of it is left behind on the disk
+            if (!journal.writeSlot(file, slotsOffset, journal.offset, journal.encrypt ? chunk : original) || !Utils::syncFile(file)
+                || !file.seek(journal.offset) || (file.write(chunk) != chunk.size())) {
+                setTaskFailed(QString("'%1': %2").arg(file.fileName()).arg(file.errorString()));
+
+                return;
+            }
+
+            if (Settings::instance().bypassPageCache())
+                Utils::dropReadCache(file, journal.offset, chunk.size());
+
+            journal.offset += chunk.size();
+            const auto newProgress = 100 * journal.offset / journal.payloadSize;
+            if (newProgress > progress)
+                setTaskProgress(progress = newProgress);
+        }
+    } catch (const Exception &e) {
+        setTaskFailed(e.errorMessage());
+
+        return;
+    }
+
+    // Once the last chunk is durable the journal is marked as done, so the slots are no longer needed
+    if (QFile::exists(journalFileName)) {
+        if (!Utils::syncFile(file)) {
+            setTaskFailed(QString("'%1': %2").arg(file.fileName()).arg(file.errorString()));
+
+            return;
+        }
+
+        if (!journal.save(journalFileName, errorString)) {
+            setTaskFailed(QString("'%1': %2").arg(journalFileName).arg(errorString));
+
+            return;
+        }
+    }
+
+    // Both operations are idempotent, so they are simply repeated after a crash
+    auto finished = file.resize(journal.payloadSize);
+    if (finished && journal.encrypt)
+        finished = file.seek(journal.payloadSize) && (file.write(journal.trailer) == journal.trailer.size());
+
+    if (!finished || !Utils::syncFile(file)) {
+        setTaskFailed(QString("'%1': %2").arg(file.fileName()).arg(file.errorString()));
+
+        return;
+    }
+
+    file.close();
+    QFile::remove(journalFileName);
+
+    auto outputFileName = inputFileName;
+    if (journal.encrypt)
+        outputFileName += encryptedFileExt;
+    else if (outputFileName.endsWith(encryptedFileExt))
+        outputFileName.chop(encryptedFileExt.length());
+
+    if (outputFileName != inputFileName) {
+        const auto reservedFileName = FileNameAllocator::instance().reserve(outputFileName, journal.encrypt, errorString);
+        if (reservedFileName.isEmpty()) {
+            setTaskFailed(QString("'%1': %2").arg(outputFileName).arg(errorString));
+
+            return;
+        }
+
+        QFile::remove(reservedFileName);
+        if (!file.rename(reservedFileName)) {
+            setTaskFailed(QString("'%1': %2").arg(reservedFileName).arg(file.errorString()));
+            FileNameAllocator::instance().release(reservedFileName);
+
+            return;
+        }
+
+        outputFileName = reservedFileName;
+    }
+
+    setTaskOutputFile(outputFileName);
+    setTaskState(Task::State::Succeded);
+}
+
+void TaskJob::doPackJob()
+{
+    const QDir folder(_task->inputFile());
+
+    QStringList filePaths;
+    qint64 totalSize = 0;
+    QDirIterator iterator(folder.absolutePath(), QDir::Files | QDir::Hidden | QDir::NoSymLinks, QDirIterator::Subdirectories);
+    while (iterator.hasNext()) {
+        iterator.next();
+        if (!iterator.fileName().endsWith(journalFileExt)) {
+            filePaths << iterator.filePath();
+            totalSize += iterator.fileInfo().size();
+        }
+    }
+
+    QString errorString;
+    const auto outputFileName = FileNameAllocator::instance().reserve(folder.absolutePath() + archiveFileExt, false, errorString);
+    if (outputFileName.isEmpty()) {
+        setTaskFailed(QString("'%1': %2").arg(folder.absolutePath() + archiveFileExt).arg(errorString));
+
+        return;
+    }
+
+    ArchiveWriter writer(outputFileName);
+    if (!writer.open(Settings::instance().key(), errorString)) {
+        setTaskFailed(QString("'%1': %2").arg(outputFileName).arg(errorString));
+        QFile::remove(outputFileName);
+        FileNameAllocator::instance().release(outputFileName);
+
+        return;
+    }
+
+    QMutex lastErrorMutex;
+    QString lastError;
+    const auto onProgress = sizeProgress(totalSize);
+
+    // Files are encrypted by this job's thread and the free threads of the worker pool, the first failure stops the remaining ones
+    forEachParallel(filePaths.size(), [&] (const int index) {
+        if (_interruptionRequested)
+            return;
+
+        const auto &filePath = filePaths.at(index);
+        QString fileErrorString;
+        if (!writer.addFile(filePath, folder.relativeFilePath(filePath), _interruptionRequested, onProgress, fileErrorString)) {
+            QMutexLocker locker(&lastErrorMutex);
+            if (lastError.isEmpty())
+                lastError = fileErrorString;
+            _interruptionRequested = true;
+        }
+    });
+
+    if (lastError.isEmpty() && _interruptionRequested)
+        lastError = "Aborted";
+
+    if (lastError.isEmpty() && !writer.finish(errorString))
+        lastError = QString("'%1': %2").arg(outputFileName).arg(errorString);
+
+    if (!lastError.isEmpty()) {
+        setTaskFailed(lastError);
+        QFile::remove(outputFileName);
+        FileNameAllocator::instance().release(outputFileName);
+
+        return;
+    }
+
+    setTaskOutputFile(outputFileName);
+    setTaskState(Task::State::Succeded);
+}
+
+void TaskJob::doUnpackJob()
+{
+    const auto inputFileName = _task->inputFile();
+
+    QString errorString;
+    ArchiveReader reader(inputFileName);
+    if (!reader.open(decryptionKeys(), errorString)) {
+        setTaskFailed(QString("'%1': %2").arg(inputFileName).arg(errorString));
+
+        return;
+    }
+
+    // The folder name is reserved like a file name and then replaced by the folder itself
+    const auto folderName = inputFileName.left(inputFileName.length() - archiveFileExt.length());
+    const auto outputFolderName = FileNameAllocator::instance().reserve(folderName, false, errorString);
+    if (outputFolderName.isEmpty()) {
+        setTaskFailed(QString("'%1': %2").arg(folderName).arg(errorString));
+
+        return;
+    }
+
+    QFile::remove(outputFolderName);
+    if (!QDir().mkdir(outputFolderName)) {
+        setTaskFailed(QString("'%1': Unable to create the folder").arg(outputFolderName));
+        FileNameAllocator::instance().release(outputFolderName);
+
+        return;
+    }
+
+    const auto &entries = reader.entries();
+    const auto totalSize = std::accumulate(entries.cbegin(), entries.cend(), qint64(0), [] (const qint64 size, const ArchiveEntry &entry) {
+        return (size + entry.size);
+    });
+
+    QMutex lastErrorMutex;
+    QString lastError;
+    const auto onProgress = sizeProgress(totalSize);
+
+    forEachParallel(entries.size(), [&] (const int index) {
+        if (_interruptionRequested)
+            return;
+
+        QString entryErrorString;
+        if (!reader.extract(entries.at(index), outputFolderName, _interruptionRequested, onProgress, entryErrorString)) {
+            QMutexLocker locker(&lastErrorMutex);
+            if (lastError.isEmpty())
+                lastError = entryErrorString;
+            _interruptionRequested = true;
+        }
+    });
+
+    if (lastError.isEmpty() && _interruptionRequested)
+        lastError = "Aborted";
+
+    if (!lastError.isEmpty()) {
+        setTaskFailed(lastError);
+        QDir(outputFolderName).removeRecursively();
+        FileNameAllocator::instance().release(outputFolderName);
+
+        return;
+    }
+
+    setTaskOutputFile(outputFolderName);
+    setTaskState(Task::State::Succeded);
+}
+
+void TaskJob::doDedupJob()
+{
+    const auto inputFileName = _task->inputFile();
+
+    QFile inputFile(inputFileName);
+    if (!inputFile.open(QFile::ReadOnly)) {
+        setTaskFailed(QString("'%1': %2").arg(inputFile.fileName()).arg(inputFile.errorString()));
+
+        return;
+    }
+
+    const auto incremental = Settings::instance().incremental();
+    Manifest::Entry state;
+    QString previousOutputFileName;
+    if (incremental && skipUnchanged(chunkListFileExt, state, previousOutputFileName))
+        return;
+
+    QString errorString;
+    ChunkStore store(Settings::instance().chunkStoreFolder());
+    if (!store.open(decryptionKeys(), true, errorString)) {
+        setTaskFailed(errorString);
+
+        return;
+    }
+
+    static const qint64 readSize = 4 * 1024 * 1024;
+
+    const auto inputSize = inputFile.size();
+    QVector<ChunkStore::Reference> references;
+    QByteArray buffer;
+    auto position = 0, progress = 0;
+    qint64 doneSize = 0;
+
+    while (true) {
+        if (_interruptionRequested) {
+            setTaskFailed("Aborted");
+
+            return;
+        }
+
+        // A cut point can only be chosen with a whole maximal chunk in view, or at the end of the file
+        if ((buffer.size() - position < Chunker::maxSize) && !inputFile.atEnd()) {
+            buffer.remove(0, position);
+            position = 0;
 
-// TaskJob
+            const auto data = inputFile.read(readSize);
+            if (data.isEmpty()) {
+                setTaskFailed(QString("'%1': %2").arg(inputFile.fileName()).arg(inputFile.errorString()));
 
-TaskJob::TaskJob(TaskPtr task, QObject *parent)
-    : QObject(parent)
-    , QRunnable()
-    , _task(task)
-    , _running(false)
-{
-    setAutoDelete(false);
-}
+                return;
+            }
 
-void TaskJob::run()
-{
-    _interruptionRequested = false;
-    _running = true;
+            checkpoint(data.size());
 
-    doJob();
+            buffer += data;
 
-    _running = false;
-    _finished.wakeAll();
+            continue;
+        }
 
-    Q_EMIT finished();
-}
+        if (position == buffer.size())
+            break;
 
-void TaskJob::doJob() noexcept
-{
-    Q_ASSERT(Q_NULLPTR != _task);
-    setTaskState(Task::State::Running);
+        const auto length = Chunker::cut(reinterpret_cast<const uchar*>(buffer.constData()) + position, buffer.size() - position);
 
-    auto encrypt = true;
-    auto outputFileName = _task->inputFile();
+        ChunkStore::Reference reference;
+        auto written = false;
+        if (!store.put(QByteArray::fromRawData(buffer.constData() + position, length), reference, written, errorString)) {
+            setTaskFailed(errorString);
+
+            return;
+        }
 
-    static const QString encryptedFileExt = ".haralug";
+        references << reference;
+        position += length;
+        doneSize += length;
 
-    if (outputFileName.endsWith(encryptedFileExt)) {
-        encrypt = false;
-        outputFileName = outputFileName.left(outputFileName.length() - encryptedFileExt.length());
-    } else {
-        outputFileName += encryptedFileExt;
+        const auto newProgress = 100 * doneSize / inputSize;
+        if (newProgress > progress)
+            setTaskProgress(progress = newProgress);
     }
 
-    improveFilePath(outputFileName, encrypt);
+    if (!store.sync(errorString)) {
+        setTaskFailed(errorString);
 
-    QFile inputFile(_task->inputFile());
-    if (!inputFile.open(QFile::ReadOnly)) {
-        setTaskLastError(QString("'%1': %2").arg(inputFile.fileName()).arg(inputFile.errorString()));
-        setTaskState(Task::State::Failed);
+        return;
+    }
+
+    auto outputFileName = FileNameAllocator::instance().reserve(inputFileName + chunkListFileExt, true, errorString);
+    if (outputFileName.isEmpty()) {
+        setTaskFailed(QString("'%1': %2").arg(inputFileName + chunkListFileExt).arg(errorString));
+
+        return;
+    }
+
+    if (!store.saveList(outputFileName, references, errorString)) {
+        setTaskFailed(QString("'%1': %2").arg(outputFileName).arg(errorString));
+        QFile::remove(outputFileName);
+        FileNameAllocator::instance().release(outputFileName);
 
         return;
     }
 
-    const auto signature = Settings::instance().signature();
-    Q_ASSERT(!signature.isEmpty());
+    if (incremental) {
+        // The chunk ids are keyed hashes of the contents, so hashing them is as good as hashing the file
+        QByteArray ids;
+        for (const auto &i : references)
+            ids += i.id;
+
+        outputFileName = replacePreviousOutput(outputFileName, previousOutputFileName);
+        state.hash = Factory::hash(ids, Factory::SHA::SHA256);
+        state.outputFile = outputFileName;
+        Manifest::instance().update(inputFileName, state);
+    }
+
+    setTaskOutputFile(outputFileName);
 
-    if (!encrypt && (inputFile.read(signature.size()) != signature)) {
-            setTaskLastError("Wrong password");
-            setTaskState(Task::State::Failed);
+    if (Settings::instance().secureDelete()) {
+        inputFile.close();
+        if (!Utils::secureRemove(inputFile.fileName(), errorString)) {
+            setTaskFailed(QString("'%1': %2").arg(inputFile.fileName()).arg(errorString));
 
             return;
+        }
     }
 
-    QFile outputFile(outputFileName);
+    setTaskState(Task::State::Succeded);
+}
+
+void TaskJob::doRestoreJob()
+{
+    const auto inputFileName = _task->inputFile();
+
+    QString errorString;
+    ChunkStore store(Settings::instance().chunkStoreFolder());
+    if (!store.open(decryptionKeys(), false, errorString)) {
+        setTaskFailed(errorString);
+
+        return;
+    }
+
+    QVector<ChunkStore::Reference> references;
+    if (!store.loadList(inputFileName, references, errorString)) {
+        setTaskFailed(QString("'%1': %2").arg(inputFileName).arg(errorString));
+
+        return;
+    }
+
+    const auto outputFileName = inputFileName.left(inputFileName.length() - chunkListFileExt.length());
+    const auto reservedFileName = FileNameAllocator::instance().reserve(outputFileName, false, errorString);
+    if (reservedFileName.isEmpty()) {
+        setTaskFailed(QString("'%1': %2").arg(outputFileName).arg(errorString));
+
+        return;
+    }
+
+    QFile outputFile(reservedFileName);
+    auto failJob = [&] (const QString &lastError) {
+        setTaskFailed(lastError);
+        outputFile.close();
+        outputFile.remove();
+        FileNameAllocator::instance().release(reservedFileName);
+    };
+
     if (!outputFile.open(QFile::WriteOnly)) {
-        setTaskLastError(QString("'%1': %2").arg(outputFileName).arg(outputFile.errorString()));
-        setTaskState(Task::State::Failed);
+        failJob(QString("'%1': %2").arg(reservedFileName).arg(outputFile.errorString()));
 
         return;
     }
 
-    if (encrypt)
-        outputFile.write(signature);
+    auto progress = 0;
+    QByteArray data;
+    for (auto i = 0; i < references.size(); ++i) {
+        if (_interruptionRequested) {
+            failJob("Aborted");
 
-    const auto password = Settings::instance().password();
+            return;
+        }
 
-    try {
-        CipherPtr cipher(Factory::instance().createCipher(password, encrypt));
-        Q_ASSERT(cipher);
+        if (!store.get(references.at(i), data, errorString)) {
+            failJob(errorString);
 
-        auto progress = 0;
-        while (!inputFile.atEnd()) {
-            if (_interruptionRequested) {
-                setTaskLastError("Aborted");
-                setTaskState(Task::State::Failed);
-                outputFile.close();
-                outputFile.remove();
+            return;
+        }
 
-                return;
-            }
+        checkpoint(data.size());
 
-            static const auto bufferSize = 1024;
-            outputFile.write(cipher->update(inputFile.read(bufferSize)));
-            const auto newProgress = 100 * inputFile.pos() / inputFile.size();
-            if (newProgress > progress)
-                setTaskProgress(progress = newProgress);
+        if (outputFile.write(data) != data.size()) {
+            failJob(QString("'%1': %2").arg(reservedFileName).arg(outputFile.errorString()));
+
+            return;
         }
 
-        outputFile.write(cipher->updateFinal());
-        setTaskOutputFile(outputFileName);
-        setTaskState(Task::State::Succeded);
-    } catch (const Exception &e) {
-        setTaskLastError(e.errorMessage());
-        setTaskState(Task::State::Failed);
+        const auto newProgress = 100 * (i + 1) / references.size();
+        if (newProgress > progress)
+            setTaskProgress(progress = newProgress);
+    }
+
+    if (!outputFile.flush()) {
+        failJob(QString("'%1': %2").arg(reservedFileName).arg(outputFile.errorString()));
+
+        return;
     }
+
+    setTaskOutputFile(reservedFileName);
+    setTaskState(Task::State::Succeded);
 }
 
-void TaskJob::improveFilePath(QString &filePath, bool encrypted)
+bool TaskJob::skipUnchanged(const QString &outputFileExt, Manifest::Entry &state, QString &previousOutputFileName)
 {
-    QFileInfo info(filePath);
+    const auto inputFileName = _task->inputFile();
 
-    const auto absolutePath = info.absolutePath();
-    const auto fileName     = info.fileName();
+    // An output of the other kind (plain encryption versus chunk list) is not reused
+    Manifest::Entry previous;
+    if (!Manifest::fileState(inputFileName, state) || !Manifest::instance().find(inputFileName, previous)
+        || !previous.outputFile.endsWith(outputFileExt) || !QFile::exists(previous.outputFile))
+        return false;
 
-    QString baseName, suffix;
-    QRegExp regExp;
+    previousOutputFileName = previous.outputFile;
 
-    if (encrypted) {
-        regExp.setPattern("^(.+)\\.([^\\.]+\\.[^\\.]+)$");
-        if (regExp.exactMatch(fileName)) {
-            baseName = regExp.cap(1);
-            suffix   = regExp.cap(2);
-        } else {
-            regExp.setPattern("^(\\.[^\\.]+)\\.([^\\.]+)$");
-            if (regExp.exactMatch(fileName)) {
-                baseName = regExp.cap(1);
-                suffix   = regExp.cap(2);
-            } else {
-                baseName = info.baseName();
-                suffix   = info.suffix();
-            }
-        }
-    } else {
-        regExp.setPattern("^(.+)\\.([^\\.]+)$");
-        if (regExp.exactMatch(fileName)) {
-            baseName = regExp.cap(1);
-            suffix   = regExp.cap(2);
-        } else {
-            regExp.setPattern("^(\\.[^\\.]+)$");
-            if (regExp.exactMatch(fileName))
-                baseName = regExp.cap(1);
-            else
-                baseName = fileName;
+    // Usually a lookup and a stat() decide; the contents are compared only when just the metadata differs.
+    // Chunk lists record a hash of chunk ids, re-chunking is cheap enough to simply run the job instead
+    auto unchanged = (state.size == previous.size) && (state.modified == previous.modified) && (state.inode == previous.inode);
+    if (!unchanged && (state.size == previous.size) && !previous.hash.isEmpty() && (encryptedFileExt == outputFileExt))
+        unchanged = (Manifest::fileHash(inputFileName) == previous.hash);
+
+    if (!unchanged)
+        return false;
+
+    if ((state.modified != previous.modified) || (state.inode != previous.inode)) {
+        state.hash = previous.hash;
+        state.outputFile = previous.outputFile;
+        Manifest::instance().update(inputFileName, state);
+    }
+
+    setTaskOutputFile(previous.outputFile);
+    setTaskLastError("unchanged");
+    setTaskProgress(100);
+    setTaskState(Task::State::Succeded);
+
+    return true;
+}
+
+QString TaskJob::replacePreviousOutput(const QString &outputFileName, const QString &previousOutputFileName)
+{
+    if (previousOutputFileName.isEmpty() || (previousOutputFileName == outputFileName))
+        return outputFileName;
+
+    // The previous output goes only once its replacement is complete; if it can't be replaced, both are kept
+    if (!QFile::remove(previousOutputFileName) || !QFile::rename(outputFileName, previousOutputFileName))
+        return outputFileName;
+
+    FileNameAllocator::instance().release(outputFileName);
+
+    return previousOutputFileName;
+}
+
+ArchiveWriter::ProgressCallback TaskJob::sizeProgress(const qint64 totalSize)
+{
+    struct State {
+        std::atomic<qint64> doneSize;
+        std::atomic_int progress;
+    };
+
+    // Called from several workers at once, only the one that advances the percentage reports it
+    auto state = QSharedPointer<State>::create();
+
+    return [this, totalSize, state] (const qint64 size) {
+        checkpoint(size);
+        const auto newProgress = static_cast<int>(100 * (state->doneSize += size) / totalSize);
+        auto oldProgress = state->progress.load();
+        while ((newProgress > oldProgress) && !state->progress.compare_exchange_weak(oldProgress, newProgress)) {}
+        if (newProgress > oldProgress)
+            setTaskProgress(newProgress);
+    };
+}
+
+bool TaskJob::selectKey(const std::function<bool (const Settings::Keys &)> &matches, QByteArray &key)
+{
+    for (const auto &i : Settings::instance().decryptionKeys()) {
+        if (matches(i)) {
+            key = i.key;
+
+            return true;
         }
     }
 
-    quint64 index = 1;
-    while (QFile::exists(filePath))
-        filePath = QString("%1/%2-%3%4").arg(absolutePath).arg(baseName).arg(index++).arg(suffix.isEmpty() ? QString() : QString(".%1").arg(suffix));
+    return false;
+}
+
+bool TaskJob::matchesPassword(QFile &file, const Settings::Keys &keys)
+{
+    try {
+        FileHeader header;
+        if (FileHeader::hasMagic(file))
+            return (header.read(file) && header.checkKey(keys.key));
+
+        QByteArray trailer;
+        if (readInPlaceTrailer(file, trailer, header))
+            return header.checkKey(keys.key);
+    } catch (const Exception &) {
+        return false;
+    }
+
+    // Only the legacy CBC format still starts with the signature of the password
+    return (file.seek(0) && (file.read(keys.signature.size()) == keys.signature));
+}
+
+QByteArray TaskJob::inPlaceTrailer(const FileHeader &header)
+{
+    auto trailer = header.toByteArray();
+    const auto headerSize = trailer.size();
+    for (auto shift = 24; shift >= 0; shift -= 8)
+        trailer.append(static_cast<char>((headerSize >> shift) & 0xff));
+
+    return (trailer + inPlaceMagic);
+}
+
+bool TaskJob::parseInPlaceTrailer(const QByteArray &trailer, FileHeader &header)
+{
+    if (!trailer.endsWith(inPlaceMagic))
+        return false;
+
+    QBuffer buffer;
+    buffer.setData(trailer.left(trailer.size() - inPlaceMagic.size() - 4));
+
+    return (buffer.open(QBuffer::ReadOnly) && FileHeader::hasMagic(buffer) && header.read(buffer) && buffer.atEnd()
+        && (Algorithm::Aes256Ctr == header.algorithm) && (header.iv.size() == Factory::streamIvSize));
+}
+
+bool TaskJob::readInPlaceTrailer(QFile &file, QByteArray &trailer, FileHeader &header)
+{
+    // The size of the header and the magic end the file, a header is never that large
+    static const qint64 maxHeaderSize = 1024;
+
+    const auto tailSize = 4 + inPlaceMagic.size();
+    if ((file.size() < tailSize) || !file.seek(file.size() - tailSize))
+        return false;
+
+    const auto tail = file.read(tailSize);
+    if ((tail.size() != tailSize) || !tail.endsWith(inPlaceMagic))
+        return false;
+
+    qint64 headerSize = 0;
+    for (auto i = 0; i < 4; ++i)
+        headerSize = (headerSize << 8) | static_cast<quint8>(tail.at(i));
+
+    if ((headerSize <= 0) || (headerSize > maxHeaderSize) || (file.size() < headerSize + tailSize)
+        || !file.seek(file.size() - tailSize - headerSize))
+        return false;
+
+    trailer = file.read(headerSize + tailSize);
+
+    return ((trailer.size() == headerSize + tailSize) && parseInPlaceTrailer(trailer, header));
 }
 
 void TaskJob::setTaskOutputFile(const QString &outputFile)
@@ -177,20 +1186,41 @@ void TaskJob::setTaskProgress(int progress)
     QMetaObject::invokeMethod(_task, "setProgress", Q_ARG(int, progress));
 }
 
+void TaskJob::checkpoint(const qint64 size)
+{
+    ThreadPool::instance()->waitWhilePaused(this);
+    Throttle::instance().acquire(size, _interruptionRequested);
+}
+
 void TaskJob::setTaskState(Task::State state)
 {
     Q_ASSERT(Q_NULLPTR != _task);
     QMetaObject::invokeMethod(_task, "setState", Q_ARG(Task::State, state));
 }
 
+void TaskJob::setTaskFailed(const QString &lastError)
+{
+    setTaskLastError(lastError);
+    setTaskState(Task::State::Failed);
+}
+
 // ThreadPool
 
 ThreadPool::ThreadPool()
     : QObject()
     , _state(State::Stopped)
     , _threadPool(new QThreadPool(this))
+    , _jobsAdded(0)
+    , _activeJobs(0)
+    , _heldJobs(0)
+    , _dispatching(false)
+    , _paused(false)
+    , _cpuNodes(Utils::cpuNodes())
+    , _nextNode(0)
 {
     qRegisterMetaType<ThreadPool::State>();
+
+    applyLimits();
 }
 
 ThreadPool::~ThreadPool()
@@ -209,22 +1239,33 @@ bool ThreadPool::addTask(TaskPtr task)
 {
     Q_ASSERT(Q_NULLPTR != task);
 
-    for (auto i : _jobs) {
-        if (i.task == task)
-            return false;
-    }
+    // Watched folders may add tens of thousands of tasks at once
+    if (_jobTasks.contains(task))
+        return false;
 
     auto job = new TaskJob(task, this);
-    connect(job, &TaskJob::finished, this, [this, job] () {
-        for (auto i : _jobs) {
-            if (i.job->isRunning())
-                return;
-        }
-        Q_EMIT stateChanged(_state = ThreadPool::State::Stopped);
+    job->_queueKey.second = _jobsAdded++;
+    connect(job, &TaskJob::finished, this, [this] () {
+        QMutexLocker locker(&_queueMutex);
+        if (((State::Running != _state) && (State::Paused != _state)) || (_activeJobs > 0) || (_heldJobs > 0) || !_queue.isEmpty())
+            return;
+
+        locker.unlock();
+        QString errorString;
+        Manifest::instance().save(errorString);
+
+        // In continuous mode the queue stays up and waits for new tasks
+        if (!Settings::instance().continuous())
+            Q_EMIT stateChanged(_state = ThreadPool::State::Stopped);
     });
     _jobs << JobInfo { task, job };
-    if (State::Running == _state)
-        _threadPool->start(job);
+    _jobTasks.insert(task);
+    if ((State::Running == _state) || (State::Paused == _state)) {
+        task->setState(Task::State::Queued);
+        QMutexLocker locker(&_queueMutex);
+        enqueue(job);
+        dispatch();
+    }
 
     return true;
 }
@@ -233,12 +1274,22 @@ void ThreadPool::removeTask(int index)
 {
     Q_ASSERT((index >= 0) && (index < _jobs.size()));
 
-    QPointer<TaskJob> job(_jobs.takeAt(index).job);
+    const auto info = _jobs.takeAt(index);
+    _jobTasks.remove(info.task);
+    QPointer<TaskJob> job(info.job);
     Q_ASSERT(job);
-    _threadPool->cancel(job);
+
+    QMutexLocker queueLocker(&_queueMutex);
+    dequeue(job);
+    if (job->_held) {
+        job->_held = false;
+        --_heldJobs;
+    }
+    queueLocker.unlock();
+
     if (job->isRunning()) {
         connect(job, &TaskJob::finished, job, &TaskJob::deleteLater);
-        job->requestInterruption();
+        interrupt(job);
         QMutexLocker locker(&_jobFinishedMutex);
         job->_finished.wait(locker.mutex());
     } else {
@@ -246,17 +1297,63 @@ void ThreadPool::removeTask(int index)
     }
 }
 
+void ThreadPool::setTaskPriority(int index, int priority)
+{
+    Q_ASSERT((index >= 0) && (index < _jobs.size()));
+
+    const auto &info = _jobs.at(index);
+    info.task->setPriority(priority);
+
+    QMutexLocker locker(&_queueMutex);
+    if (info.job->_queued) {
+        dequeue(info.job);
+        enqueue(info.job);
+    }
+}
+
+void ThreadPool::runTaskNext(int index)
+{
+    Q_ASSERT((index >= 0) && (index < _jobs.size()));
+
+    QMutexLocker locker(&_queueMutex);
+    auto priority = _jobs.at(index).task->priority();
+    if (!_queue.isEmpty())
+        priority = qMax(priority, 1 - _queue.firstKey().first);
+    locker.unlock();
+
+    setTaskPriority(index, priority);
+}
+
+const int ThreadPool::defaultExpiryTimeout = 30000;
+
 bool ThreadPool::start()
 {
-    if ((State::Stopped == _state) && !_jobs.isEmpty()) {
+    const auto continuous = Settings::instance().continuous();
+    if ((State::Stopped == _state) && (!_jobs.isEmpty() || continuous)) {
         Q_EMIT stateChanged(_state = State::Starting);
 
+        // Idle workers wait for the next job instead of expiring, they are woken when it is dispatched
+        _threadPool->setExpiryTimeout(continuous ? -1 : defaultExpiryTimeout);
+
+        FileNameAllocator::instance().clear();
+
+        // Without its manifest a run simply processes every file, which is no reason to refuse to start
+        QString errorString;
+        if (Settings::instance().incremental())
+            Manifest::instance().load(Settings::instance().key(), errorString);
+
+        QMutexLocker locker(&_queueMutex);
         for (auto &i : _jobs) {
             i.task->setState(Task::State::Queued);
             Q_ASSERT(!i.job->isRunning());
-            _threadPool->start(i.job);
+            i.job->_pauseRequested = false;
+            enqueue(i.job);
         }
 
+        _dispatching = true;
+        dispatch();
+        locker.unlock();
+
         Q_EMIT stateChanged(_state = State::Running);
 
         return true;
@@ -267,20 +1364,41 @@ bool ThreadPool::start()
 
 bool ThreadPool::stop()
 {
-    if (State::Running == _state)
+    if ((State::Running == _state) || (State::Paused == _state))
     {
         Q_EMIT stateChanged(_state = State::Stopping);
 
+        QMutexLocker locker(&_queueMutex);
+        _dispatching = false;
+        for (auto i : _queue)
+            i->_queued = false;
+        _queue.clear();
+        locker.unlock();
+
         _threadPool->clear();
         for (auto &i : _jobs) {
-            if (i.job->isRunning()) {
-                i.job->requestInterruption();
-            } else {
+            if (i.job->isRunning())
+                interrupt(i.job);
+        }
+        _threadPool->waitForDone();
+
+        // Jobs taken off the thread pool's own queue never ran, held ones were never given back
+        locker.relock();
+        _activeJobs = 0;
+        _heldJobs = 0;
+        _paused = false;
+        locker.unlock();
+
+        for (auto &i : _jobs) {
+            if ((Task::State::Queued == i.task->state()) || i.job->_held) {
+                i.job->_held = false;
                 i.task->setLastError("Aborted");
                 i.task->setState(Task::State::Failed);
             }
         }
-        _threadPool->waitForDone();
+
+        QString errorString;
+        Manifest::instance().save(errorString);
 
         Q_EMIT stateChanged(_state = State::Stopped);
 
@@ -289,3 +1407,151 @@ bool ThreadPool::stop()
 
     return false;
 }
+
+bool ThreadPool::pause()
+{
+    if (State::Running == _state) {
+        QMutexLocker locker(&_queueMutex);
+        _paused = true;
+        locker.unlock();
+
+        Q_EMIT stateChanged(_state = State::Paused);
+
+        return true;
+    }
+
+    return false;
+}
+
+bool ThreadPool::resume()
+{
+    if (State::Paused == _state) {
+        QMutexLocker locker(&_queueMutex);
+        _paused = false;
+        _pauseCondition.wakeAll();
+        dispatch();
+        locker.unlock();
+
+        Q_EMIT stateChanged(_state = State::Running);
+
+        return true;
+    }
+
+    return false;
+}
+
+void ThreadPool::setTaskPaused(int index, bool paused)
+{
+    Q_ASSERT((index >= 0) && (index < _jobs.size()));
+
+    const auto &info = _jobs.at(index);
+    QMutexLocker locker(&_queueMutex);
+    if (!_dispatching || (paused == info.job->_pauseRequested))
+        return;
+
+    info.job->_pauseRequested = paused;
+    if (paused && info.job->_queued) {
+        // A pending job is simply held back, it doesn't need a worker to wait in
+        dequeue(info.job);
+        info.job->_held = true;
+        ++_heldJobs;
+        info.task->setState(Task::State::Paused);
+    } else if (!paused && info.job->_held) {
+        info.job->_held = false;
+        --_heldJobs;
+        info.task->setState(Task::State::Queued);
+        enqueue(info.job);
+        dispatch();
+    } else if (!paused) {
+        _pauseCondition.wakeAll();
+    }
+}
+
+void ThreadPool::waitWhilePaused(TaskJobPtr job)
+{
+    if (!_paused && !job->_pauseRequested)
+        return;
+
+    // The worker waits with its files and cipher state as they are; its thread is lent to the pool meanwhile
+    QMutexLocker locker(&_queueMutex);
+    if (0 == job->_parkedThreads++) {
+        --_activeJobs;
+        ++_heldJobs;
+        _threadPool->releaseThread();
+        job->setTaskState(Task::State::Paused);
+        dispatch();
+    }
+
+    while ((_paused || job->_pauseRequested) && !job->_interruptionRequested)
+        _pauseCondition.wait(&_queueMutex);
+
+    if (0 == --job->_parkedThreads) {
+        _threadPool->reserveThread();
+        ++_activeJobs;
+        --_heldJobs;
+        job->setTaskState(Task::State::Running);
+    }
+}
+
+void ThreadPool::interrupt(TaskJobPtr job)
+{
+    job->requestInterruption();
+
+    QMutexLocker locker(&_queueMutex);
+    _pauseCondition.wakeAll();
+}
+
+void ThreadPool::applyLimits()
+{
+    Throttle::instance().setRate(static_cast<qint64>(Settings::instance().maxSpeed()) * 1024 * 1024);
+
+    const auto maxWorkers = Settings::instance().maxWorkers();
+    _threadPool->setMaxThreadCount((maxWorkers > 0) ? maxWorkers : QThread::idealThreadCount());
+
+    // More workers start at once, fewer take effect as the running jobs finish
+    QMutexLocker locker(&_queueMutex);
+    dispatch();
+}
+
+void ThreadPool::enqueue(TaskJobPtr job)
+{
+    Q_ASSERT(!job->_queued);
+
+    job->_queueKey.first = -job->_task->priority();
+    job->_queued = true;
+    _queue.insert(job->_queueKey, job);
+}
+
+void ThreadPool::dequeue(TaskJobPtr job)
+{
+    if (job->_queued) {
+        _queue.remove(job->_queueKey);
+        job->_queued = false;
+    }
+}
+
+void ThreadPool::dispatch()
+{
+    while (_dispatching && !_paused && (_activeJobs < _threadPool->maxThreadCount()) && !_queue.isEmpty()) {
+        auto job = _queue.take(_queue.firstKey());
+        job->_queued = false;
+        ++_activeJobs;
+        _threadPool->start(job);
+    }
+}
+
+void ThreadPool::jobDone()
+{
+    QMutexLocker locker(&_queueMutex);
+    --_activeJobs;
+    dispatch();
+}
+
+QVector<int> ThreadPool::workerCpus(const QString &fileName)
+{
+    auto node = Utils::deviceNode(fileName);
+    while ((node < 0) || (node >= _cpuNodes.size()) || _cpuNodes.at(node).isEmpty())
+        node = _nextNode++ % _cpuNodes.size();
+
+    return _cpuNodes.at(node);
+}
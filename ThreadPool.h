@@ -2,15 +2,26 @@
 #define THREADPOOL_H
 
 #include <QList>
+#include <QMap>
 #include <QMutex>
+#include <QPair>
 #include <QObject>
 #include <QRunnable>
+#include <QSet>
 #include <QWaitCondition>
 
+#include <functional>
+
+#include "Archive.h"
+#include "Manifest.h"
+#include "Settings.h"
 #include "TaskManager.h"
 
+class QFile;
 class QThreadPool;
 
+struct FileHeader;
+
 // TaskJob
 class TaskJob : public QObject, public QRunnable
 {
@@ -22,6 +33,18 @@ private:
     TaskJob(TaskPtr task, QObject *parent);
 
 public:
+    static const QString encryptedFileExt;
+    static const QString journalFileExt;
+    static const QString archiveFileExt;
+    static const QString chunkListFileExt;
+
+    // Reads only the header, the in-place trailer or the legacy prefix, never the payload
+    static bool matchesPassword(QFile &file, const Settings::Keys &keys);
+
+    // A file encrypted in place ends with its header, the size of the header and the magic
+    static QByteArray inPlaceTrailer(const FileHeader &header);
+    static bool readInPlaceTrailer(QFile &file, QByteArray &trailer, FileHeader &header);
+
     bool isRunning() const { return _running; }
     void requestInterruption() { _interruptionRequested = true; }
 
@@ -31,17 +54,50 @@ protected:
     void run() Q_DECL_OVERRIDE;
 
 private:
-    static void improveFilePath(QString &filePath, bool encrypted);
+    static bool parseInPlaceTrailer(const QByteArray &trailer, FileHeader &header);
+
+    // Picks the first of the decryption keys the file accepts
+    static bool selectKey(const std::function<bool (const Settings::Keys &)> &matches, QByteArray &key);
+
+    // Applies the priorities and the affinity from the settings to the calling thread
+    void applyWorkerSettings();
+    // Runs the function for every index in [0, count) on this thread and on the idle threads of the worker pool
+    void forEachParallel(const int count, const std::function<void (int)> &function);
 
     void doJob() noexcept;
+    void doCopyJob();
+    void doInPlaceJob();
+    void doPackJob();
+    void doUnpackJob();
+    void doDedupJob();
+    void doRestoreJob();
+
+    bool skipUnchanged(const QString &outputFileExt, Manifest::Entry &state, QString &previousOutputFileName);
+    QString replacePreviousOutput(const QString &outputFileName, const QString &previousOutputFileName);
+
+    ArchiveWriter::ProgressCallback sizeProgress(const qint64 totalSize);
 
     void setTaskOutputFile(const QString &outputFile);
     void setTaskLastError(const QString &lastError);
     void setTaskProgress(int progress);
     void setTaskState(Task::State state);
+    void setTaskFailed(const QString &lastError);
+
+    // Called between chunks: waits while the job or the pool is paused, then throttles the bytes that follow
+    void checkpoint(const qint64 size);
+
+    static const QByteArray inPlaceMagic;
+    static const qint64 cacheRegionSize;
 
     TaskPtr _task;
+    // The position in the pending queue: the negated priority and the order the job was added in
+    QPair<int, quint64> _queueKey;
+    bool _queued;
+    // Paused before it was started
+    bool _held;
+    int _parkedThreads;
     std::atomic_bool _running;
+    std::atomic_bool _pauseRequested;
     std::atomic_bool _interruptionRequested;
     QWaitCondition _finished;
 };
@@ -61,6 +117,7 @@ public:
     enum class State {
         Starting,
         Running,
+        Paused,
         Stopping,
         Stopped
     };
@@ -73,19 +130,57 @@ public:
     bool addTask(TaskPtr task);
     void removeTask(int index);
 
+    // Moves a pending task within the queue without restarting anything
+    void setTaskPriority(int index, int priority);
+    void runTaskNext(int index);
+
+    // Applies the speed and worker limits from the settings, also while running
+    void applyLimits();
+
     bool start();
     bool stop();
 
+    // Running jobs wait at the next chunk boundary and continue where they were
+    bool pause();
+    bool resume();
+    void setTaskPaused(int index, bool paused);
+
 private:
     struct JobInfo {
         TaskPtr task;
         TaskJobPtr job;
     };
 
+    friend class TaskJob;
+
+    void enqueue(TaskJobPtr job);
+    void dequeue(TaskJobPtr job);
+    void dispatch();
+    void jobDone();
+    void waitWhilePaused(TaskJobPtr job);
+    void interrupt(TaskJobPtr job);
+    // The CPUs of the NUMA node nearest to the file, nodes are taken in turn when it is unknown
+    QVector<int> workerCpus(const QString &fileName);
+
+    static const int defaultExpiryTimeout;
+
     ThreadPool::State _state;
     QList<JobInfo> _jobs;
+    QSet<TaskPtr> _jobTasks;
     QThreadPool *_threadPool;
     QMutex _jobFinishedMutex;
+    // Jobs are handed to the thread pool only when a thread is free, so the queue can still be reordered
+    QMap<QPair<int, quint64>, TaskJobPtr> _queue;
+    QMutex _queueMutex;
+    quint64 _jobsAdded;
+    int _activeJobs;
+    // Paused jobs, whether they have started or not
+    int _heldJobs;
+    bool _dispatching;
+    std::atomic_bool _paused;
+    QWaitCondition _pauseCondition;
+    const QVector<QVector<int>> _cpuNodes;
+    std::atomic_uint _nextNode;
 };
 
 Q_DECLARE_METATYPE(ThreadPool::State)
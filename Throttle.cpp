@@ -0,0 +1,56 @@
+#include "Throttle.h"
+
+#include <QThread>
+
+// Throttle
+
+// Up to a quarter of a second worth of bytes may pass at once, so short idle periods aren't lost
+const qint64 Throttle::burstTime = 250 * 1000 * 1000;
+
+Throttle::Throttle()
+    : _rate(0)
+    , _generation(0)
+    , _paidTime(0)
+{
+    _timer.start();
+}
+
+Throttle& Throttle::instance()
+{
+    static Throttle instance;
+
+    return instance;
+}
+
+void Throttle::setRate(const qint64 rate)
+{
+    QMutexLocker locker(&_mutex);
+    if (rate != _rate) {
+        _rate = rate;
+        _paidTime = _timer.nsecsElapsed();
+        ++_generation;
+    }
+}
+
+void Throttle::acquire(const qint64 bytes, const std::atomic_bool &interruptionRequested)
+{
+    if ((_rate <= 0) || (bytes <= 0))
+        return;
+
+    // A virtual clock shared by all jobs: each request is granted once the previous ones have been paid for
+    QMutexLocker locker(&_mutex);
+    const auto rate = _rate.load();
+    if (rate <= 0)
+        return;
+
+    const auto generation = _generation.load();
+    const auto now = _timer.nsecsElapsed();
+    _paidTime = qMax(_paidTime, now);
+    const auto grantTime = _paidTime - burstTime;
+    _paidTime += static_cast<qint64>(1e9 * bytes / rate);
+    locker.unlock();
+
+    // Slept in slices, so neither an interruption nor a new rate has to wait for the whole delay
+    for (auto time = now; (time < grantTime) && !interruptionRequested && (generation == _generation); time = _timer.nsecsElapsed())
+        QThread::msleep(static_cast<unsigned long>(qBound<qint64>(1, (grantTime - time) / (1000 * 1000), 100)));
+}
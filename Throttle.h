@@ -0,0 +1,39 @@
+#ifndef THROTTLE_H
+#define THROTTLE_H
+
+#include <QElapsedTimer>
+#include <QMutex>
+
+#include <atomic>
+
+// Throttle
+class Throttle
+{
+    Q_DISABLE_COPY(Throttle)
+
+private:
+    Throttle();
+    virtual ~Throttle() {}
+
+public:
+    static Throttle& instance();
+
+    // Bytes per second shared by all jobs, 0 means unlimited
+    qint64 rate() const { return _rate; }
+    void setRate(const qint64 rate);
+
+    // Blocks until the bytes fit into the rate; returns early when interrupted or when the rate changes
+    void acquire(const qint64 bytes, const std::atomic_bool &interruptionRequested);
+
+private:
+    static const qint64 burstTime;
+
+    QMutex _mutex;
+    QElapsedTimer _timer;
+    std::atomic<qint64> _rate;
+    std::atomic_int _generation;
+    // The time at which everything granted so far will have been paid for
+    qint64 _paidTime;
+};
+
+#endif // THROTTLE_H
@@ -1,69 +1,279 @@
 #include "Utils.h"
 
-#include <cmath>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QMutex>
+#include <QThread>
+
+#include <algorithm>
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#ifdef Q_OS_LINUX
+#include <pthread.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#endif
 
 // Utils
 
-int Utils::passwordStrength(const QString &password)
+bool Utils::syncFile(QFile &file)
+{
+    if (!file.flush())
+        return false;
+
+#ifdef Q_OS_WIN
+    return (0 == ::_commit(file.handle()));
+#else
+    return (0 == ::fsync(file.handle()));
+#endif
+}
+
+bool Utils::syncFolder(const QString &folder)
+{
+#ifdef Q_OS_WIN
+    // Folders can't be synced on Windows, NTFS journals their entries anyway
+    Q_UNUSED(folder)
+
+    return true;
+#else
+    const auto handle = ::open(QFile::encodeName(folder).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (handle < 0)
+        return false;
+
+    const auto result = ::fsync(handle);
+    ::close(handle);
+
+    return (0 == result);
+#endif
+}
+
+void Utils::dropReadCache(QFile &file, const qint64 offset, const qint64 length)
+{
+#if defined(POSIX_FADV_DONTNEED)
+    if (length > 0)
+        ::posix_fadvise(file.handle(), offset, length, POSIX_FADV_DONTNEED);
+#else
+    Q_UNUSED(file)
+    Q_UNUSED(offset)
+    Q_UNUSED(length)
+#endif
+}
+
+void Utils::dropWriteCache(QFile &file, const qint64 previousOffset, const qint64 offset, const qint64 length)
+{
+    // Dirty pages can't be dropped, so the new range is only queued for writeback
+    // and the previous one, which has normally been written meanwhile, is evicted;
+    // only these two ranges are walked, however large the file has grown
+    file.flush();
+
+#if defined(Q_OS_LINUX)
+    if (length > 0)
+        ::sync_file_range(file.handle(), offset, length, SYNC_FILE_RANGE_WRITE);
+
+    if (offset > previousOffset)
+        ::sync_file_range(file.handle(), previousOffset, offset - previousOffset, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+#else
+    Q_UNUSED(length)
+#endif
+
+    dropReadCache(file, previousOffset, offset - previousOffset);
+}
+
+bool Utils::secureRemove(const QString &fileName, QString &errorString)
 {
-    if (password.isEmpty())
-        return 0;
-
-    static const QString lower   = "abcdefghijklmnopqrstuvwxyz";
-    static const QString upper   = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
-    static const QString symbols = "~`!@#$%^&*()-_+=";
-    static const QString digits  = "1234567890";
-
-    enum Options {
-        HasLower   = 1 << 0,
-        HasUpper   = 1 << 1,
-        HasDigits  = 1 << 2,
-        HasSymbols = 1 << 3,
-        HasOther   = 1 << 4
-    };
-
-    int options = 0;
-
-    foreach (const QChar &i, password) {
-        if (lower.contains(i))
-            options |= HasLower;
-        else if (upper.contains(i))
-            options |= HasUpper;
-        else if (digits.contains(i))
-            options |= HasDigits;
-        else if (symbols.contains(i))
-            options |= HasSymbols;
-        else
-            options |= HasOther;
+    QFile file(fileName);
+    if (!file.open(QFile::ReadWrite)) {
+        errorString = file.errorString();
+
+        return false;
     }
 
-    int strength = 0;
+    static const qint64 bufferSize = 1024 * 1024;
+    const QByteArray zeros(bufferSize, 0);
 
-    if (options & HasLower)
-        strength += lower.length();
+    const auto size = file.size();
+    for (qint64 written = 0; written < size; ) {
+        const auto length = file.write(zeros.constData(), qMin(bufferSize, size - written));
+        if (length <= 0) {
+            errorString = file.errorString();
 
-    if (options & HasUpper)
-        strength += upper.length();
+            return false;
+        }
+        written += length;
+    }
 
-    if (options & HasSymbols)
-        strength += symbols.length();
+    if (!syncFile(file) || !file.resize(0)) {
+        errorString = file.errorString();
 
-    if (options & HasDigits)
-        strength += digits.length();
+        return false;
+    }
 
-    if (options & HasOther)
-        strength += 0x7f - 0x20 - (lower.length() + upper.length() + symbols.length() + digits.length());
+    file.close();
+    if (!file.remove()) {
+        errorString = file.errorString();
 
-    strength = std::floor(std::log(strength) * (password.length() / std::log(2)));
+        return false;
+    }
 
-    if (strength >= 128)
-        return 4;
+    return true;
+}
 
-    if (strength >= 64)
-        return 3;
+void Utils::setThreadPriority(const int niceness, const Utils::IoPriority ioPriority)
+{
+#if defined(Q_OS_LINUX)
+    // On Linux both priorities belong to threads rather than to the whole process
+    const auto tid = static_cast<id_t>(::syscall(SYS_gettid));
+    ::setpriority(PRIO_PROCESS, tid, niceness);
 
-    if (strength >= 56)
-        return 2;
+    static const int ioprioWhoProcess = 1, ioprioClassShift = 13;
+    static const int ioprioClassNone = 0, ioprioClassBestEffort = 2, ioprioClassIdle = 3;
+    auto ioprio = ioprioClassNone << ioprioClassShift;
+    if (IoPriority::Low == ioPriority)
+        ioprio = (ioprioClassBestEffort << ioprioClassShift) | 7;
+    else if (IoPriority::Idle == ioPriority)
+        ioprio = ioprioClassIdle << ioprioClassShift;
+    ::syscall(SYS_ioprio_set, ioprioWhoProcess, tid, ioprio);
+#elif defined(Q_OS_WIN)
+    auto priority = THREAD_PRIORITY_NORMAL;
+    if (niceness >= 15)
+        priority = THREAD_PRIORITY_IDLE;
+    else if (niceness >= 10)
+        priority = THREAD_PRIORITY_LOWEST;
+    else if (niceness > 0)
+        priority = THREAD_PRIORITY_BELOW_NORMAL;
 
-    return 1;
+    ::SetThreadPriority(::GetCurrentThread(), priority);
+
+    // Background mode lowers the I/O priority as well; it can't be entered twice, so it is always left first
+    ::SetThreadPriority(::GetCurrentThread(), THREAD_MODE_BACKGROUND_END);
+    if (IoPriority::Normal != ioPriority)
+        ::SetThreadPriority(::GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+#else
+    Q_UNUSED(niceness)
+    Q_UNUSED(ioPriority)
+#endif
+}
+
+QVector<QVector<int>> Utils::cpuNodes()
+{
+    QVector<QVector<int>> nodes;
+
+#if defined(Q_OS_LINUX)
+    // Each node lists its CPUs as ranges, e.g. "0-7,16-23"
+    const QDir nodesDir("/sys/devices/system/node");
+    for (const auto &i : nodesDir.entryList({ "node*" }, QDir::Dirs)) {
+        bool ok = false;
+        const auto node = i.mid(4).toInt(&ok);
+        if (!ok)
+            continue;
+
+        QFile file(nodesDir.filePath(i + "/cpulist"));
+        if (!file.open(QFile::ReadOnly))
+            continue;
+
+        QVector<int> cpus;
+        for (const auto &range : QString::fromLatin1(file.readAll()).trimmed().split(',', QString::SkipEmptyParts)) {
+            const auto bounds = range.split('-');
+            const auto first = bounds.first().toInt();
+            const auto last = bounds.last().toInt();
+            for (auto cpu = first; cpu <= last; ++cpu)
+                cpus << cpu;
+        }
+
+        if (node >= nodes.size())
+            nodes.resize(node + 1);
+        nodes[node] = cpus;
+    }
+#endif
+
+    if (std::all_of(nodes.cbegin(), nodes.cend(), [] (const QVector<int> &cpus) { return cpus.isEmpty(); })) {
+        nodes.clear();
+        QVector<int> cpus;
+        for (auto cpu = 0; cpu < QThread::idealThreadCount(); ++cpu)
+            cpus << cpu;
+        nodes << cpus;
+    }
+
+    return nodes;
+}
+
+int Utils::deviceNode(const QString &fileName)
+{
+#if defined(Q_OS_LINUX)
+    struct stat status;
+    if (0 != ::stat(QFile::encodeName(QFileInfo(fileName).absolutePath()).constData(), &status))
+        return -1;
+
+    // The answer only depends on the device, and many files share a few devices
+    static QMutex mutex;
+    static QHash<quint64, int> nodes;
+    QMutexLocker locker(&mutex);
+    const auto device = static_cast<quint64>(status.st_dev);
+    const auto cached = nodes.constFind(device);
+    if (nodes.constEnd() != cached)
+        return cached.value();
+
+    // A partition has no device of its own, its parent disk does
+    auto node = -1;
+    auto blockDir = QFileInfo(QString("/sys/dev/block/%1:%2").arg(major(status.st_dev)).arg(minor(status.st_dev))).canonicalFilePath();
+    for (auto level = 0; (level < 2) && !blockDir.isEmpty(); ++level) {
+        QFile file(blockDir + "/device/numa_node");
+        if (file.open(QFile::ReadOnly)) {
+            node = file.readAll().trimmed().toInt();
+            break;
+        }
+        blockDir = QFileInfo(blockDir).absolutePath();
+    }
+    nodes.insert(device, node);
+
+    return node;
+#else
+    Q_UNUSED(fileName)
+
+    return -1;
+#endif
+}
+
+void Utils::setThreadAffinity(const QVector<int> &cpus)
+{
+#if defined(Q_OS_LINUX)
+    // The main thread keeps the affinity the process was started with, e.g. by taskset
+    cpu_set_t processSet;
+    if (0 != ::sched_getaffinity(::getpid(), sizeof(processSet), &processSet))
+        return;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto cpu : cpus) {
+        if ((cpu < CPU_SETSIZE) && CPU_ISSET(cpu, &processSet))
+            CPU_SET(cpu, &set);
+    }
+    ::pthread_setaffinity_np(::pthread_self(), sizeof(set), (0 != CPU_COUNT(&set)) ? &set : &processSet);
+#elif defined(Q_OS_WIN)
+    DWORD_PTR processMask = 0, systemMask = 0;
+    if (!::GetProcessAffinityMask(::GetCurrentProcess(), &processMask, &systemMask))
+        return;
+
+    DWORD_PTR mask = 0;
+    for (auto cpu : cpus) {
+        if (cpu < static_cast<int>(sizeof(mask) * 8))
+            mask |= static_cast<DWORD_PTR>(1) << cpu;
+    }
+    mask &= processMask;
+    ::SetThreadAffinityMask(::GetCurrentThread(), (0 != mask) ? mask : processMask);
+#else
+    Q_UNUSED(cpus)
+#endif
 }
@@ -2,6 +2,9 @@
 #define UTILS_H
 
 #include <QString>
+#include <QVector>
+
+class QFile;
 
 // Utils
 class Utils
@@ -13,7 +16,29 @@ private:
     virtual ~Utils() {}
 
 public:
-    static int passwordStrength(const QString &password);
+    enum class IoPriority {
+        Normal,
+        Low,
+        Idle
+    };
+
+    static bool syncFile(QFile &file);
+    // Makes the creation and renaming of the files in the folder durable, where the system allows it
+    static bool syncFolder(const QString &folder);
+    static void dropReadCache(QFile &file, const qint64 offset, const qint64 length);
+    // Queues [offset, offset + length) for writeback and evicts the region queued by the previous call, which starts at previousOffset
+    static void dropWriteCache(QFile &file, const qint64 previousOffset, const qint64 offset, const qint64 length);
+    static bool secureRemove(const QString &fileName, QString &errorString);
+    // Applies to the calling thread only; raising the priority back may need privileges and is done where allowed
+    static void setThreadPriority(const int niceness, const Utils::IoPriority ioPriority);
+
+    // The CPUs of every NUMA node by node number, empty for nodes with memory only;
+    // a single node with all CPUs where the topology is unknown
+    static QVector<QVector<int>> cpuNodes();
+    // The NUMA node of the device that holds the file, -1 if it is unknown
+    static int deviceNode(const QString &fileName);
+    // Applies to the calling thread only, an empty list allows every CPU again
+    static void setThreadAffinity(const QVector<int> &cpus);
 };
 
 #endif // UTILS_H
@@ -2,10 +2,19 @@
 #include <QDir>
 #include <QLockFile>
 
+#include "CommandLine.h"
 #include "MainWindow.h"
 
 int main(int argc, char *argv[])
 {
+    if (CommandLine::isBatchMode(argc, argv)) {
+        QCoreApplication application(argc, argv);
+        application.setApplicationName("Haralug");
+        application.setOrganizationName("popov895");
+
+        return CommandLine::exec(application.arguments());
+    }
+
     QApplication application(argc, argv);
     application.setApplicationName("Haralug");
     application.setOrganizationName("popov895");